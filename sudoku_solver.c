@@ -6,12 +6,118 @@
 	Date: 15 April 2010
 
 	Compilation:
-	$ gcc solverc. -o solver
+	$ gcc -O2 -pthread sudoku_solver.c -o solver		(bitsudoku.inc must be next to it)
+	or make, and make lib for the static and shared libraries of sudoku_solver.h (compiled
+	with -DSUDOKU_LIBRARY, which leaves main out).
 	
 	Usage:
-	$ ./solver < puzzle.txt
+	$ ./solver [--engine=bitmask|counter|simd|dlx] [--propagate=none|singles|full] [--backtrack=undo|copy|iterative]
+	           [--max-nodes=K] [--max-time=MS] [--threads=T] [--slow-lane=L [--slow-nodes=K] [--slow-time=MS]]
+	           [--search-threads=S [--split-depth=D]]
+	           [--cell-order=first|degree] [--value-order=ascending|lcv] [--branch=cell|unit] [--restarts=K]
+	           [--lane-depth=D] [--profile] [--phase-counter=EVENT]
+	           [--input=FILE] [--output=grid|linear|stats|count|rating|profile [--count-limit=L]] <1=linear | 2=grid | 3=packed> < puzzle.txt
 	
-	Format of puzzle input data:
+	Output: each solution as a grid followed by a blank line (default), each solution on one
+	line, the statistics of each search (backtracks first, see sprint_stats), the number
+	of solutions of each puzzle: 0, 1 or 2+ (up to L with --count-limit, bitmask engine only; timeout
+	beyond --max-nodes or --max-time),
+	or its difficulty rating, the same whatever the engine and options (see sprint_rating),
+	or the hardware counters of each solve (see sprint_profile).
+	--summary prints the statistics of the whole run to stderr.
+	Compile with -DSOLVER_STATS=0 to leave out everything but nodes and backtracks, or with
+	-DSOLVER_STATS=2 to also measure where the time goes.
+	
+	Profiling (Linux perf events; --output=profile implies --profile):
+	
+	--profile              counts cycles, instructions, branch-misses, l1d-misses and llc-misses
+	                       around every solve, in each thread; --summary adds their totals
+	--phase-counter=EVENT  with -DSOLVER_STATS=2, the phase timings (choosing the cell, inserting
+	                       and removing numbers, propagating) count EVENT instead of clock ticks
+	make pgo               builds the solver with profile-guided optimization, trained on
+	                       analysis/puzzles.txt
+	
+	Benchmark:
+	$ ./solver --bench [--warmup=W] [--repeat=R] [--bench-format=csv|json] [solver options]
+	           --input=FILE... <1=linear | 2=grid | 3=packed>
+	
+	Streaming (records one by one through bounded queues, for endless input):
+	$ ./solver --stream[=ordered|unordered] [--threads=T] [solver options] [--input=FILE] <1=linear | 2=grid | 3=packed>
+	
+	Ranking (writes DIR/top<K>.txt, the K puzzles with the most backtracks, or the highest ratings
+	with --output=rating, and DIR/histogram.txt):
+	$ ./solver --rank=DIR [--top=K] [--threads=T] [solver options] [--input=FILE] <1=linear | 2=grid | 3=packed>
+	
+	Sharding (the I-th of K parts of FILE, resumed from its checkpoint in DIR after a crash; see
+	shard_corpus), and the merge of the K shards once they are complete:
+	$ ./solver --shard=I/K [--checkpoint=DIR | --rank=DIR [--top=K]] [--checkpoint-interval=S] [--threads=T] [solver options]
+	           --input=FILE <1=linear | 3=packed>
+	$ ./solver --merge=DIR [--summary]
+	
+	Generator (COUNT new minimal 9x9 puzzles, optionally within bands of clues and rating):
+	$ ./solver --generate=COUNT [--seed=S] [--clues=MIN-MAX] [--rating=MIN-MAX] [--threads=T] [--summary]
+	
+	Conversion to the packed format (see below):
+	$ ./solver --pack [--input=FILE] <1=linear | 2=grid> < puzzle.txt > puzzle.bin
+	
+	Service:
+	$ ./solver --serve=unix:PATH|tcp:[HOST:]PORT [--threads=T] [solver options]
+	
+	Answers linear puzzles sent one per line over the socket with one line each: solved,
+	unsolvable, timeout (see --max-nodes and --max-time) or error, then the solution or count, then the
+	statistics. T threads serve up to T connections at once.
+	
+	Engines:
+	
+	bitmask  keeps one used-digit bitmask per row, column and box (default)
+	counter  the original constraint counter cube, kept as a reference (9x9 boards only)
+	simd     bitmask, after propagating groups of 8 or 16 9x9 puzzles at once in AVX2 or AVX-512 lanes
+	         (and searching them there, up to D levels, with --lane-depth=D)
+	dlx      dancing links: branches on the cell, or number of a unit, with the fewest options
+	
+	Propagation (bitmask engine only), run after every insertion before branching again:
+	
+	none     plain backtracking, as the counter engine does
+	singles  fills cells with a single hypothesis, and the only cell of a unit where a number fits (default)
+	full     singles plus locked candidates (box/line intersections)
+
+	Backtracking (bitmask engine only):
+
+	undo     replays the insertions and eliminations of a failed branch in reverse (default)
+	copy     saves the board at every branching node and copies it back after a failed branch
+	iterative  undo, keeping the search path in an explicit stack of nodes instead of recursing
+
+	With --max-nodes=K, the bitmask engine gives up a puzzle after K nodes of search (using the
+	iterative search) and prints it unsolved; --summary counts the timeouts. --max-time=MS
+	does the same after MS milliseconds (fractions allowed) of search on the wall clock.
+	With --slow-lane=L, the puzzles given up go on instead, from where they stopped, in L
+	threads of their own, up to K nodes in all (--slow-nodes, 0 for no limit) and MS more
+	milliseconds (--slow-time); only those given up there print unsolved. Records still come
+	out in input order, and --summary counts the puzzles requeued.
+	
+	Branching heuristics (bitmask engine, undo backtracking, one search thread):
+	
+	--cell-order=degree   breaks ties between the most constrained cells by their number of empty peers
+	--value-order=lcv     tries first the numbers that remove the fewest hypothesis from the peers
+	--branch=unit         branches on the places of a number in a unit when they are fewer than
+	                      the hypothesis of the most constrained cell
+	--restarts=K          random tie-breaks, starting over after K nodes, then 2K, 4K...
+	                      (--summary counts the restarts)
+	
+	With --cache=E, up to E solutions are kept by canonical form, and repeated puzzles, or
+	puzzles that only differ by symmetries and relabelled numbers, skip the search; --summary
+	adds the cache hits and misses.
+	
+	With --threads=T (T > 1), puzzles are read in chunks and solved by T worker threads;
+	solutions are still printed in input order.
+	With --stream, records are read, solved (by T workers) and written one by one in a
+	pipeline, for input that never ends; with --stream=unordered they are written as soon
+	as solved, after their record number.
+	With --search-threads=S (S > 1), S threads share the search of each single puzzle: the
+	top D levels of the search tree (3 by default) are split into tasks they steal from each other.
+	
+	Format of puzzle input data (9x9 shown; 4x4, 16x16 and 25x25 boards work the same way,
+	with numbers above 9 written A to P):
 	
 	1. Grid format:
 	
@@ -29,26 +135,340 @@
 	
 	530070000600195000098000060800060003400803001700020006060000280000419005000080079
 	
+	3. Packed format: binary, 41 bytes per 9x9 puzzle (see read_packed), written by --pack.
+	
 */	
 
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "sudoku_solver.h"
 
+// Board size of the counter engine. The bitmask engine is built for every size from 2x2
+// boxes (4x4 boards) to MAX_SQRT_N, and picks the size of each puzzle as it reads it.
 #define SQRT_N 3
 #define N (SQRT_N * SQRT_N) 
 
+#define MAX_SQRT_N 5
+#define MAX_N (MAX_SQRT_N * MAX_SQRT_N)
+
+// name_16 for BOARD_SIZE 16, see bitsudoku.inc
+#define SIZED_NAME(name, size) name##_##size
+#define SIZED2(name, size) SIZED_NAME(name, size)
+#define SIZED(name) SIZED2(name, BOARD_SIZE)
+
+// symbol of each number when printed, and of number+1 when read: 1-9 then A-P
+static const char digit_symbols[] = "0123456789ABCDEFGHIJKLMNOP"; 
+
 // Data Types
 
+/*
+	Everything written by one thread at a time and kept in arrays or next to what other threads
+	touch (solver states, boards, chunks of the batch mode, cache shards, ...) is aligned to
+	cache lines, so that two threads never write to the same line (false sharing). Aligned
+	types are allocated with alloc_aligned, as malloc only aligns to 16 bytes.
+*/
+#define CACHE_LINE 64
+#define CACHE_ALIGNED __attribute__ ((aligned (CACHE_LINE)))
+
+void * alloc_aligned(size_t bytes)
+{
+	void * p = aligned_alloc(CACHE_LINE, (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+	assert(p != NULL);
+	return p;
+}
+
+/*
+	Statistics of one solve. Nodes and backtracks are always counted. SOLVER_STATS selects the rest:
+	0  nothing else: every other update is compiled out of the search (the fields stay 0)
+	1  counters (default)
+	2  counters and time, in ticks: TSC cycles on x86, nanoseconds elsewhere. Reading the
+	   clock at every insertion costs about a third of the solving speed.
+*/
+#ifndef SOLVER_STATS
+#define SOLVER_STATS 1
+#endif
+
+#if SOLVER_STATS >= 1
+#define STAT(statement) statement
+#else
+#define STAT(statement)
+#endif
+
+#if SOLVER_STATS >= 2
+#define TIME_STAT(statement) statement
+#else
+#define TIME_STAT(statement)
+#endif
+
+// hardware events counted by --profile, and by the phase timings with --phase-counter
+#define PROFILE_EVENTS 5
+static const char * const profile_event_names[PROFILE_EVENTS] = { "cycles", "instructions", "branch-misses", "l1d-misses", "llc-misses" };
+
+typedef struct {
+	long long nodes;			// calls to solve(), i.e. nodes of the search tree
+	long long backtracks;
+	int max_depth;				// most branching choices open at the same time
+	long long branching[MAX_N+1];	// nodes by number of hypothesis of the cell they branch on
+	long long propagated;		// cells filled by propagation
+	long long eliminated;		// other hypothesis removed by propagation
+	unsigned long long pick_ticks;		// time choosing the most constrained cell
+	unsigned long long change_ticks;	// time inserting and removing numbers
+	unsigned long long propagate_ticks;	// time in propagation (including its insertions)
+	long long timeouts;			// searches given up at the node or time limit
+	long long requeued;			// searches given up in batch mode that went on in the slow lane
+	long long restarts;			// searches started over by --restarts
+	long long solutions;		// solutions found: 0 or 1, or up to the limit of --output=count
+	unsigned long long counters[PROFILE_EVENTS];	// with --profile, see profile_event_names
+} solver_stats;
+
+/*
+	Hardware counters, read with perf_event_open (Linux only). With --profile, every thread
+	that solves puzzles opens one group of the PROFILE_EVENTS events, counting only itself
+	in user space, and reads it before and after each solve (a single read for the group).
+	The events the machine cannot count (in a virtual machine without a PMU, or with
+	kernel.perf_event_paranoid above 2) are left out of the group and stay 0.
+*/
+#ifdef __linux__
+static const struct {
+	unsigned int type;
+	unsigned long long config;
+} profile_event_codes[PROFILE_EVENTS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES }		// of the last level cache
+};
+
+// opens event for the calling thread, in the group of leader (-1 for a new group); returns its fd, or -1
+static int open_event(int event, int leader)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = profile_event_codes[event].type;
+	attr.config = profile_event_codes[event].config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+#endif
+
+typedef struct {
+	int leader;		// fd of the group, -1 if no event could be opened
+	int nevents;
+	int fd[PROFILE_EVENTS];		// of each event of the group, in the order they were added
+	int event[PROFILE_EVENTS];	// index in profile_event_names of each
+} profile_counters;
+
+/*
+	Opens the counters of the calling thread. Returns the number of events opened; with
+	verbose, prints why each of the others could not be.
+*/
+int open_profile(profile_counters * pc, int verbose)
+{
+	pc->leader = -1;
+	pc->nevents = 0;
+#ifdef __linux__
+	int e, fd;
+	for(e = 0; e < PROFILE_EVENTS; e++)
+		if ((fd = open_event(e, pc->leader)) >= 0)
+			{
+				if (pc->leader < 0)
+					pc->leader = fd;
+				pc->fd[pc->nevents] = fd;
+				pc->event[pc->nevents++] = e;
+			}
+		else if (verbose)
+			fprintf(stderr, "--profile: %s cannot be counted (%s)\n", profile_event_names[e], strerror(errno));
+#endif
+	return pc->nevents;
+}
+
+void close_profile(profile_counters * pc)
+{
+	int k;
+	for(k = 0; k < pc->nevents; k++)
+		close(pc->fd[k]);
+	pc->leader = -1;
+	pc->nevents = 0;
+}
+
+// the current values of the counters, 0 for the events not opened
+void read_profile(const profile_counters * pc, unsigned long long * values)
+{
+	unsigned long long group[1 + PROFILE_EVENTS];	// number of events, then their values
+	int k;
+	memset(values, 0, PROFILE_EVENTS * sizeof(unsigned long long));
+	if (pc->leader < 0 || read(pc->leader, group, sizeof(group)) < (ssize_t) sizeof(group[0]))
+		return;
+	for(k = 0; k < pc->nevents && k < (int) group[0]; k++)
+		values[pc->event[k]] = group[1 + k];
+}
+
+// adds what the counters counted since before to counters
+void add_profile(const profile_counters * pc, const unsigned long long * before, unsigned long long * counters)
+{
+	unsigned long long now[PROFILE_EVENTS];
+	int e;
+	read_profile(pc, now);
+	for(e = 0; e < PROFILE_EVENTS; e++)
+		counters[e] += now[e] - before[e];
+}
+
+/*
+	With --phase-counter (in a SOLVER_STATS=2 build) the phase timings count one of the events
+	instead of clock ticks. read_ticks is called at every insertion, far too often for a
+	system call: where the kernel lets user space read the counter (rdpmc on x86), it reads it
+	through the page of the event mapped in memory, as perf does, and falls back on read()
+	elsewhere. The counter belongs to the thread that opened it and stays open until it exits.
+*/
+#if SOLVER_STATS >= 2 && defined(__linux__)
+#define PHASE_COUNTERS
+static __thread int phase_fd = -1;		// -1: read_ticks reads the clock
+static __thread volatile struct perf_event_mmap_page * phase_page;	// NULL: read phase_fd
+
+static inline unsigned long long read_phase_counter(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (phase_page)
+		{
+			unsigned long long count;
+			unsigned int seq, index;
+			do
+				{
+					// the kernel bumps lock while it moves the counter (at a context switch)
+					seq = phase_page->lock;
+					__asm__ volatile ("" ::: "memory");
+					index = phase_page->index;
+					count = phase_page->offset;
+					if (index)		// 0 while the event is not on the PMU
+						{
+							int shift = 64 - phase_page->pmc_width;
+							count += (long long) (__rdpmc(index - 1) << shift) >> shift;
+						}
+					__asm__ volatile ("" ::: "memory");
+				}
+			while(phase_page->lock != seq);
+			return count;
+		}
+#endif
+	unsigned long long group[2] = { 0, 0 };
+	if (read(phase_fd, group, sizeof(group)) < (ssize_t) sizeof(group))
+		return 0;
+	return group[1];
+}
+#endif
+
+/*
+	Makes read_ticks count event in the calling thread. Returns 0 if it cannot be counted.
+*/
+int open_phase_counter(int event)
+{
+#ifdef PHASE_COUNTERS
+	if (phase_fd >= 0)
+		return 1;
+	if ((phase_fd = open_event(event, -1)) < 0)
+		return 0;
+#if defined(__x86_64__) || defined(__i386__)
+	long page_size = sysconf(_SC_PAGESIZE);
+	void * page = mmap(NULL, page_size, PROT_READ, MAP_SHARED, phase_fd, 0);
+	if (page != MAP_FAILED && ((struct perf_event_mmap_page *) page)->cap_user_rdpmc)
+		phase_page = page;
+	else if (page != MAP_FAILED)
+		munmap(page, page_size);
+#endif
+	return 1;
+#else
+	(void) event;
+	return 0;
+#endif
+}
+
+static inline unsigned long long read_ticks(void)
+{
+#ifdef PHASE_COUNTERS
+	if (phase_fd >= 0)
+		return read_phase_counter();
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ull + t.tv_nsec;
+#endif
+}
+
+// wall clock for the time budgets of --max-time, in nanoseconds
+static inline long long monotonic_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ll + t.tv_nsec;
+}
+
+/*
+	Board of the counter engine. A constraint counts the row, column, box and cell that rule
+	a number out of a cell, from -4 to 4 (while change_state_at runs), so a byte holds it:
+	the board is 810 bytes, instead of 3 KB with ints.
+*/
 typedef struct {
-	int constraints[N][N][N];
-	int inserted[N][N];
+	signed char constraints[N][N][N];
+	unsigned char inserted[N][N];
+	unsigned char possibilities[N*N][N];	// scratch space of solve(), one row per search depth
 	int ninserted;
-	int nbacktracks;
+	int depth;		// branching choices open in solve()
+	solver_stats stats;
 } sudoku;
 
-enum print_mode { HYPOTHESIS_COUNT, VALUE, ALL_HYPOTHESIS };
-enum input_type { LINEAR_INPUT=1, GRID_INPUT};
+// A puzzle as read from the input, independent of the engine that solves it
+typedef struct {
+	int box_size;		// SQRT_N of the board: 2 to MAX_SQRT_N
+	signed char cell[MAX_N*MAX_N];	// number at each cell, row by row, EMPTY_CELL if not given
+} puzzle;
+
+#define EMPTY_CELL -1
+
+// longest text print() can produce for a board of any size (ALL_HYPOTHESIS mode)
+#define BOARD_TEXT_SIZE (MAX_N * (MAX_N * (MAX_N+2) + 1) + 1)
+// longest record solve_puzzle() can produce: a MAX_N grid, or a line of statistics
+#define RECORD_TEXT_SIZE 1024
+
+enum print_mode { HYPOTHESIS_COUNT, VALUE, ALL_HYPOTHESIS, LINEAR_VALUE };
+enum input_type { LINEAR_INPUT=1, GRID_INPUT, PACKED_INPUT };
+enum output_format { GRID_OUTPUT, LINEAR_OUTPUT, STATS_OUTPUT, COUNT_OUTPUT, RATING_OUTPUT, PROFILE_OUTPUT };
+enum engine_type { BITMASK_ENGINE, COUNTER_ENGINE, SIMD_ENGINE, DLX_ENGINE };
+enum propagation_level { NO_PROPAGATION, SINGLES_PROPAGATION, FULL_PROPAGATION };
+enum backtrack_mode { UNDO_BACKTRACK, COPY_BACKTRACK, ITERATIVE_BACKTRACK };
+enum search_result { SEARCH_FAILED, SEARCH_SOLVED, SEARCH_TIMEOUT };
+enum cell_order { FIRST_CELL, DEGREE_CELL };
+enum value_order { ASCENDING_VALUES, LCV_VALUES };
+enum branch_type { CELL_BRANCHING, UNIT_BRANCHING };
 
 
 void new_sudoku(sudoku * s)
@@ -62,7 +482,8 @@ void new_sudoku(sudoku * s)
 				s->constraints[i][j][n] = 0;
 		}
 	s->ninserted = 0;
-	s->nbacktracks = 0;
+	s->depth = 0;
+	memset(&s->stats, 0, sizeof(solver_stats));
 }
 
 
@@ -110,17 +531,21 @@ void change_state_at(sudoku * s, int row, int col, int number, int type)
 void insert_number_at(sudoku * s, int row, int col, int number)
 {
 //	printf("Inserting %d at (%d, %d)\n", number+1, row+1, col+1);
+	TIME_STAT(unsigned long long start = read_ticks());
 	change_state_at(s, row, col, number, +1);
+	TIME_STAT(s->stats.change_ticks += read_ticks() - start);
 }
 
 void remove_number_at(sudoku * s, int row, int col, int number)
 {
 //	printf("Removing %d from (%d, %d)\n", number+1, row+1, col+1);
+	TIME_STAT(unsigned long long start = read_ticks());
 	change_state_at(s, row, col, number, -1);
+	TIME_STAT(s->stats.change_ticks += read_ticks() - start);
 }
 
 
-void get_possibilities_at(sudoku * s, int row, int col, int ** possibilites, int *poss_counter)
+void get_possibilities_at(sudoku * s, int row, int col, unsigned char ** possibilites, int *poss_counter)
 {
 	(*poss_counter) = 0;
 	int n;
@@ -135,7 +560,7 @@ void get_possibilities_at(sudoku * s, int row, int col, int ** possibilites, int
 		
 }
 
-void get_most_constrained_cell(sudoku *s, int *row, int *col, int ** possibilities, int *poss_count)
+void get_most_constrained_cell(sudoku *s, int *row, int *col, unsigned char ** possibilities, int *poss_count)
 {
 	int i,j, min = N+1;
 	
@@ -158,11 +583,14 @@ void get_most_constrained_cell(sudoku *s, int *row, int *col, int ** possibiliti
 
 
 /*
-Prints the sudoku board in one of 3 visualization modes
+Writes the sudoku board in one of 3 visualization modes to out, which must hold BOARD_TEXT_SIZE chars.
+Returns the length of the text (not null-terminated).
 */
-void print(sudoku * s, enum print_mode mode)
+int sprint(sudoku * s, enum print_mode mode, char * out)
 {
-	int * possibilities = malloc(N *sizeof(int));
+	char * start = out;
+	unsigned char buffer[N];
+	unsigned char * possibilities = buffer;
 	int poss_count;
 	
 	int i,j,n;
@@ -175,115 +603,4425 @@ void print(sudoku * s, enum print_mode mode)
 			switch(mode)
 			{
 			 case HYPOTHESIS_COUNT:		// shows how many open hypothesis are there in this cell
-				putchar(poss_count + '0');
+				*out++ = poss_count + '0';
 				break;
 			 case VALUE:  		// if cell value is known, print it. Otherwise show wildcard character.
+			 case LINEAR_VALUE:	// same, all on one line
 				if (poss_count == 1)
-					putchar(possibilities[0] + '1');
+					*out++ = possibilities[0] + '1';
 				else
-					putchar('*');
+					*out++ = '*';
 				break;
 			case ALL_HYPOTHESIS:			// show all open possibilites
-				putchar('[');
+				*out++ = '[';
 				for(n=0; n<N; n++)
 					if (s->constraints[i][j][n] == 0)
-						putchar(n+'1');
+						*out++ = n+'1';
 					else
-						putchar(' ');
-				putchar(']');
+						*out++ = ' ';
+				*out++ = ']';
 				break;
 			default:
 				abort();	
 			};
 		}
-		putchar('\n');
+		if (mode != LINEAR_VALUE)
+			*out++ = '\n';
 	}
-	putchar('\n');
-	
-	free(possibilities);
+	*out++ = '\n';
+	return out - start;
+}
+
+void print(sudoku * s, enum print_mode mode)
+{
+	char text[BOARD_TEXT_SIZE];
+	fwrite(text, 1, sprint(s, mode, text), stdout);
+}
+
+
+
+/*
+	Input.
+	A regular file (given with --input, or redirected to stdin) is mapped in memory and
+	parsed in place; a pipe is read in blocks of INPUT_BLOCK_SIZE bytes. Records are
+	checked as they are parsed: a wrong length, an unexpected character or two equal
+	numbers in a row, column or box stop the input with an error naming the line.
+	The size of each record is taken from its length (linear) or from the length of its
+	first line (grid): 4x4, 9x9, 16x16 or 25x25. Numbers are written 1-9 then A-P (or a-p),
+	and blank cells '0', '.' or '_'.
+*/
+
+#define INPUT_BLOCK_SIZE (1 << 20)
+
+typedef struct {
+	const char * name;
+	int fd;
+	char * data;	// the whole mapped file, or the current block
+	size_t size;	// bytes in data (where the input stops, for a shard: see shard_input)
+	size_t pos;		// start of the next line in data
+	int mapped;
+	size_t mapped_size;	// of the whole file
+	int eof;		// nothing left to read from fd
+	int too_long;	// the input stopped at a line longer than INPUT_BLOCK_SIZE
+	long line;		// number of the line starting at pos
+	int only_box_size;	// if not 0, records of any other size are errors (counter engine)
+	int packed_box_size;	// packed input: box size given by the header, 0 before it is read
+} input_reader;
+
+/*
+	Opens path, or stdin if path is NULL. Returns 0 (after printing why) if it fails.
+*/
+int open_input(input_reader * in, const char * path)
+{
+	struct stat st;
+	in->name = path ? path : "<stdin>";
+	in->fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+	in->pos = 0;
+	in->line = 1;
+	in->eof = 0;
+	in->too_long = 0;
+	in->only_box_size = 0;
+	in->packed_box_size = 0;
+	if (in->fd < 0 || fstat(in->fd, &st) < 0)
+		{
+			perror(in->name);
+			return 0;
+		}
+
+	in->mapped = S_ISREG(st.st_mode) && st.st_size > 0;
+	if (in->mapped)
+		{
+			in->size = in->mapped_size = st.st_size;
+			in->data = mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+			if (in->data == MAP_FAILED)
+				{
+					perror(in->name);
+					return 0;
+				}
+			madvise(in->data, in->size, MADV_SEQUENTIAL);
+			in->eof = 1;
+		}
+	else
+		{
+			in->size = 0;
+			in->data = malloc(INPUT_BLOCK_SIZE);
+			assert(in->data != NULL);
+		}
+	return 1;
+}
+
+/*
+	Reads from fd (a pipe or a socket), with name for the error messages.
+*/
+void open_stream(input_reader * in, int fd, const char * name)
+{
+	in->name = name;
+	in->fd = fd;
+	in->pos = 0;
+	in->line = 1;
+	in->eof = 0;
+	in->too_long = 0;
+	in->only_box_size = 0;
+	in->packed_box_size = 0;
+	in->mapped = 0;
+	in->size = 0;
+	in->data = malloc(INPUT_BLOCK_SIZE);
+	assert(in->data != NULL);
 }
 
+void close_input(input_reader * in)
+{
+	if (in->mapped)
+		munmap(in->data, in->mapped_size);
+	else
+		free(in->data);
+	if (in->fd != STDIN_FILENO)
+		close(in->fd);
+}
+
+/*
+	Returns the next line (without its end of line) and sets *length, or returns NULL at the
+	end of the input, or at a line too long for a block (in->too_long is then set, after
+	printing it). The line stays valid until the next call.
+*/
+const char * next_line(input_reader * in, size_t * length)
+{
+	for(;;)
+		{
+			char * start = in->data + in->pos;
+			char * end = memchr(start, '\n', in->size - in->pos);
+			if (end || (in->eof && in->pos < in->size))
+				{
+					if (!end)		// last line without end of line
+						end = in->data + in->size;
+					in->pos = end - in->data + (end < in->data + in->size);
+					in->line++;
+					if (end > start && end[-1] == '\r')
+						end--;
+					*length = end - start;
+					return start;
+				}
+			if (in->eof)
+				return NULL;
+
+			// move the incomplete line to the front of the block and read more after it
+			if (in->pos == 0 && in->size == INPUT_BLOCK_SIZE)
+				{
+					fprintf(stderr, "%s:%ld: line too long\n", in->name, in->line);
+					in->eof = in->too_long = 1;
+					in->size = 0;
+					return NULL;
+				}
+			memmove(in->data, start, in->size - in->pos);
+			in->size -= in->pos;
+			in->pos = 0;
+			ssize_t n = read(in->fd, in->data + in->size, INPUT_BLOCK_SIZE - in->size);
+			if (n <= 0)
+				in->eof = 1;
+			else
+				in->size += n;
+		}
+}
+
+/*
+	Returns 1 if next_line() has a line to return without reading more.
+*/
+int has_line(const input_reader * in)
+{
+	return in->eof || memchr(in->data + in->pos, '\n', in->size - in->pos) != NULL;
+}
+
+/*
+	Returns the box size of a board given by a first line of length cells: a whole board
+	(linear input) or its first row (grid input). Returns 0 if no size fits.
+*/
+int box_size_of(size_t length, enum input_type intype)
+{
+	int b;
+	for(b = 2; b <= MAX_SQRT_N; b++)
+		if (length == (size_t) (intype == LINEAR_INPUT ? b*b*b*b : b*b))
+			return b;
+	return 0;
+}
 
+/*
+	Parses count cells of text into cells, for a board with n numbers. Returns the index of
+	the first character that is neither a number up to n nor a blank, or -1 if there is none.
+*/
+int parse_cells(const char * text, int count, int n, signed char * cells)
+{
+	int k;
+	for(k = 0; k < count; k++)
+		{
+			char c = text[k];
+			int number;
+			if (c >= '1' && c <= '9')
+				number = c - '1';
+			else if (c >= 'A' && c <= 'P')
+				number = c - 'A' + 9;
+			else if (c >= 'a' && c <= 'p')
+				number = c - 'a' + 9;
+			else if (c == '0' || c == '.' || c == '_')
+				number = EMPTY_CELL;
+			else
+				return k;
+			if (number >= n)
+				return k;
+			cells[k] = number;
+		}
+	return -1;
+}
 
-void read_input(sudoku * s, enum input_type intype)
+/*
+	Returns 1 if no number is given twice in a row, column or box of p.
+*/
+int is_consistent(puzzle * p)
 {
+	unsigned int rows[MAX_N] = { 0 }, cols[MAX_N] = { 0 }, boxes[MAX_N] = { 0 };
+	int b = p->box_size, n = b * b;
 	int i,j;
-	for(i = 0; i < N; i++)
-	{
-		for(j = 0; j < N; j++)
+	for(i = 0; i < n; i++)
+		for(j = 0; j < n; j++)
+			if (p->cell[i*n + j] != EMPTY_CELL)
+				{
+					unsigned int bit = 1u << p->cell[i*n + j];
+					int box = (i / b) * b + j / b;
+					if ((rows[i] | cols[j] | boxes[box]) & bit)
+						return 0;
+					rows[i] |= bit;
+					cols[j] |= bit;
+					boxes[box] |= bit;
+				}
+	return 1;
+}
+
+/*
+	Packed binary format.
+	A header of 8 bytes, PACKED_MAGIC followed by the box size, then fixed-size records, one
+	per puzzle, all of that size: every cell in PACKED_BITS(n) bits (4 up to 9x9 boards, 5
+	above), 0 for an empty cell and k for number k, from the lowest bits of the first byte up.
+	A 9x9 puzzle takes 41 bytes instead of 82 in the linear format, and is decoded straight
+	into the puzzle without looking for ends of lines.
+*/
+
+#define PACKED_MAGIC "SDKPACK"
+#define PACKED_HEADER_SIZE 8
+#define PACKED_BITS(n) ((n) < 16 ? 4 : 5)
+#define PACKED_RECORD_SIZE(n) (((n) * (n) * PACKED_BITS(n) + 7) / 8)
+
+/*
+	Makes count bytes from in->pos available in in->data, reading more if needed. Returns 0
+	if the input ends before.
+*/
+int fill_input(input_reader * in, size_t count)
+{
+	while(in->size - in->pos < count)
 		{
-			char c = getchar();
-			if (feof(stdin))
-				exit(0);
-			if (c >= '1' && c <= '9' )
-				insert_number_at(s, i, j, c - '1');
+			if (in->eof)
+				return 0;
+			memmove(in->data, in->data + in->pos, in->size - in->pos);
+			in->size -= in->pos;
+			in->pos = 0;
+			ssize_t n = read(in->fd, in->data + in->size, INPUT_BLOCK_SIZE - in->size);
+			if (n <= 0)
+				in->eof = 1;
+			else
+				in->size += n;
 		}
-		if (intype ==  GRID_INPUT)
-			getchar(); // discards the \n at each line
-	}
-	if (intype == LINEAR_INPUT)
-		getchar(); // discards the \n only at the end
+	return 1;
 }
 
 /*
- Depth first search with backtracking.
- At each level we follow the most constrained sudoku cell (tree node with less childs). 
+	Reads the next puzzle of a packed input, like read_input; in->line counts the records.
 */
-int solve(sudoku * s)
+int read_packed(input_reader * in, puzzle * p)
 {
-	if( s->ninserted == N*N )
-		return 1;
-	
-	int row, col, poss_count, found_solution=0;
-	int * possibilities = malloc(N *sizeof(int));
-	
-	get_most_constrained_cell(s, &row, &col, &possibilities, &poss_count);
+	if (in->packed_box_size == 0)
+		{
+			int b = 0;
+			if (fill_input(in, PACKED_HEADER_SIZE) && memcmp(in->data + in->pos, PACKED_MAGIC, PACKED_HEADER_SIZE - 1) == 0)
+				b = in->data[in->pos + PACKED_HEADER_SIZE - 1];
+			if (b < 2 || b > MAX_SQRT_N)
+				{
+					fprintf(stderr, "%s: not a packed puzzle file\n", in->name);
+					return -1;
+				}
+			if (in->only_box_size && b != in->only_box_size)
+				{
+					fprintf(stderr, "%s: %dx%d boards need the bitmask engine\n", in->name, b*b, b*b);
+					return -1;
+				}
+			in->packed_box_size = b;
+			in->pos += PACKED_HEADER_SIZE;
+		}
 
-	if (poss_count == 0) // should bracktrack
+	int b = in->packed_box_size, n = b*b, bits = PACKED_BITS(n), size = PACKED_RECORD_SIZE(n);
+	int k;
+	if (in->pos == in->size && (in->eof || !fill_input(in, 1)))
+		return 0;
+	if (!fill_input(in, size))
 		{
-			s->nbacktracks++;  // just to collect statistics (not important for algorithm)
-			return 0; 
+			fprintf(stderr, "%s: record %ld: incomplete record\n", in->name, in->line);
+			in->pos = in->size;
+			return -1;
 		}
-		
-	int i;
-	for(i=0; i<poss_count; i++)
+
+	const unsigned char * record = (const unsigned char *) in->data + in->pos;
+	p->box_size = b;
+	for(k = 0; k < n*n; k++)
 		{
-			insert_number_at(s, row, col, possibilities[i]);
-			found_solution = solve(s);
-			if (found_solution)
-				break;
-			remove_number_at(s, row, col, possibilities[i]);
-			
+			int bit = k * bits, value;
+			if (bits == 4)		// nibbles, never across bytes
+				value = (record[k / 2] >> (bit % 8)) & 0xf;
+			else
+				value = ((record[bit / 8] | (bit / 8 + 1 < size ? record[bit / 8 + 1] << 8 : 0)) >> (bit % 8)) & 0x1f;
+			if (value > n)
+				{
+					fprintf(stderr, "%s: record %ld: number %d out of range at cell %d\n", in->name, in->line, value, k + 1);
+					in->pos += size;
+					in->line++;
+					return -1;
+				}
+			p->cell[k] = value - 1;		// EMPTY_CELL for 0
 		}
-	free(possibilities);
-	return found_solution;
-	
+	in->pos += size;
+	in->line++;
+	if (!is_consistent(p))
+		{
+			fprintf(stderr, "%s: record %ld: a number is given twice in the same row, column or box\n", in->name, in->line - 1);
+			return -1;
+		}
+	return 1;
 }
 
-int main (int argc, char const *argv[])
+/*
+	Reads the next puzzle. Returns 1 on success, 0 at the end of the input, and -1 (after
+	printing where and why) on a malformed record. Blank lines between records are skipped.
+*/
+int read_input(input_reader * in, puzzle * p, enum input_type intype)
 {
-	sudoku s;
-	
-	if (argc != 2)
+	const char * line;
+	size_t length;
+	int nlines = 1, width = 0, n = 0;
+	long first_line = 0;
+	int i, bad;
+
+	if (intype == PACKED_INPUT)
+		return read_packed(in, p);
+
+	for(i = 0; i < nlines; i++)
 		{
-			printf("Usage:\n $ %s <1=linear | 2=grid>\n < input_file.txt", argv[0]);
-			exit(1);
+			do
+				line = next_line(in, &length);
+			while(line && length == 0 && i == 0);
+			if (!line)
+				{
+					if (in->too_long)
+						return -1;
+					if (i == 0)
+						return 0;
+					fprintf(stderr, "%s:%ld: incomplete grid, expected %d lines\n", in->name, in->line, n);
+					return -1;
+				}
+			if (i == 0)
+				{
+					first_line = in->line - 1;
+					p->box_size = box_size_of(length, intype);
+					if (p->box_size == 0)
+						{
+							fprintf(stderr, "%s:%ld: expected %s cells, got %zu\n", in->name, first_line,
+								intype == LINEAR_INPUT ? "16, 81, 256 or 625" : "4, 9, 16 or 25", length);
+							return -1;
+						}
+					if (in->only_box_size && p->box_size != in->only_box_size)
+						{
+							fprintf(stderr, "%s:%ld: %dx%d boards need the bitmask engine\n", in->name, first_line,
+								p->box_size * p->box_size, p->box_size * p->box_size);
+							return -1;
+						}
+					n = p->box_size * p->box_size;
+					nlines = intype == LINEAR_INPUT ? 1 : n;
+					width = intype == LINEAR_INPUT ? n*n : n;
+				}
+			if (length != (size_t) width)
+				{
+					fprintf(stderr, "%s:%ld: expected %d cells, got %zu\n", in->name, in->line - 1, width, length);
+					return -1;
+				}
+			bad = parse_cells(line, width, n, p->cell + i*width);
+			if (bad >= 0)
+				{
+					fprintf(stderr, "%s:%ld: unexpected character '%c' at column %d\n", in->name, in->line - 1, line[bad], bad + 1);
+					return -1;
+				}
 		}
-		
-	int intype = atoi(argv[1]);
-	assert(intype == 1 || intype == 2);
-	
-	while(!feof(stdin))
+	if (!is_consistent(p))
 		{
-			new_sudoku(&s);
-		
-			read_input(&s, intype);
-			
-			solve(&s);
-	
-			print(&s, 1);					   // prints the solution
-			// printf("%d\n", s.nbacktracks);  // prints how many times it had to backtrack
+			fprintf(stderr, "%s:%ld: a number is given twice in the same row, column or box\n", in->name, first_line);
+			return -1;
 		}
-		
-	return 0;
-}
\ No newline at end of file
+	return 1;
+}
+
+/*
+	Output.
+	Records are copied into a large buffer that goes out in a single write(2) when full,
+	instead of one stdio call per character.
+*/
+
+#define OUTPUT_BLOCK_SIZE (1 << 20)
+
+typedef struct {
+	int fd;
+	char * data;
+	size_t length;
+} output_writer;
+
+void open_output(output_writer * w, int fd)
+{
+	w->fd = fd;
+	w->length = 0;
+	w->data = malloc(OUTPUT_BLOCK_SIZE);
+	assert(w->data != NULL);
+}
+
+void write_all(int fd, const char * text, size_t length)
+{
+	while(length > 0)
+		{
+			ssize_t n = write(fd, text, length);
+			if (n < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					perror("write");
+					exit(1);
+				}
+			text += n;
+			length -= n;
+		}
+}
+
+void flush_output(output_writer * w)
+{
+	write_all(w->fd, w->data, w->length);
+	w->length = 0;
+}
+
+void write_output(output_writer * w, const char * text, size_t length)
+{
+	if (w->length + length > OUTPUT_BLOCK_SIZE)
+		flush_output(w);
+	if (length > OUTPUT_BLOCK_SIZE)
+		write_all(w->fd, text, length);
+	else
+		{
+			memcpy(w->data + w->length, text, length);
+			w->length += length;
+		}
+}
+
+void close_output(output_writer * w)
+{
+	flush_output(w);
+	free(w->data);
+}
+
+/*
+	Writes the header of a packed file of box_size boards, to be followed by their records.
+*/
+void write_packed_header(output_writer * w, int box_size)
+{
+	char header[PACKED_HEADER_SIZE];
+	memcpy(header, PACKED_MAGIC, PACKED_HEADER_SIZE - 1);
+	header[PACKED_HEADER_SIZE - 1] = box_size;
+	write_output(w, header, PACKED_HEADER_SIZE);
+}
+
+void write_packed(output_writer * w, const puzzle * p)
+{
+	unsigned char record[PACKED_RECORD_SIZE(MAX_N)];
+	int n = p->box_size * p->box_size, bits = PACKED_BITS(n), size = PACKED_RECORD_SIZE(n);
+	int k;
+	memset(record, 0, size);
+	for(k = 0; k < n*n; k++)
+		{
+			int bit = k * bits, value = (p->cell[k] + 1) << (bit % 8);
+			record[bit / 8] |= value;
+			if (value >> 8)
+				record[bit / 8 + 1] |= value >> 8;
+		}
+	write_output(w, (const char *) record, size);
+}
+
+/*
+	Converts the puzzles of in to a packed file on w. Returns 0 on a malformed record, or on
+	a board size other than the first one (a packed file holds a single size).
+*/
+int pack_puzzles(input_reader * in, output_writer * w, enum input_type intype)
+{
+	puzzle p;
+	int status, box_size = 0;
+	while((status = read_input(in, &p, intype)) > 0)
+		{
+			if (box_size == 0)
+				write_packed_header(w, box_size = p.box_size);
+			else if (p.box_size != box_size)
+				{
+					fprintf(stderr, "%s:%ld: a packed file holds %dx%d boards only\n", in->name, in->line - 1, box_size*box_size, box_size*box_size);
+					return 0;
+				}
+			write_packed(w, &p);
+		}
+	return status == 0;
+}
+
+void load_puzzle(sudoku * s, puzzle * p)
+{
+	int i,j;
+	for(i = 0; i < N; i++)
+		for(j = 0; j < N; j++)
+			if (p->cell[i*N + j] != EMPTY_CELL)
+				insert_number_at(s, i, j, p->cell[i*N + j]);
+}
+
+/*
+ Depth first search with backtracking.
+ At each level we follow the most constrained sudoku cell (tree node with less childs). 
+*/
+int solve(sudoku * s)
+{
+	s->stats.nodes++;
+	if( s->ninserted == N*N )
+		return 1;
+	
+	int row, col, poss_count, found_solution=0;
+	// each depth has its own row, since ninserted grows by one at every level
+	unsigned char * possibilities = s->possibilities[s->ninserted];
+	
+	TIME_STAT(unsigned long long start = read_ticks());
+	get_most_constrained_cell(s, &row, &col, &possibilities, &poss_count);
+	TIME_STAT(s->stats.pick_ticks += read_ticks() - start);
+	STAT(s->stats.branching[poss_count]++);
+
+	if (poss_count == 0) // should bracktrack
+		{
+			s->stats.backtracks++;  // just to collect statistics (not important for algorithm)
+			return 0; 
+		}
+		
+	STAT(if (++s->depth > s->stats.max_depth) s->stats.max_depth = s->depth);
+	int i;
+	for(i=0; i<poss_count; i++)
+		{
+			insert_number_at(s, row, col, possibilities[i]);
+			found_solution = solve(s);
+			if (found_solution)
+				break;
+			remove_number_at(s, row, col, possibilities[i]);
+			
+		}
+	STAT(s->depth--);
+	return found_solution;
+	
+}
+
+/*
+	Adds the statistics of src to total (max_depth is the deepest of both).
+*/
+void add_stats(solver_stats * total, const solver_stats * src)
+{
+	int n;
+	total->nodes += src->nodes;
+	total->backtracks += src->backtracks;
+	if (src->max_depth > total->max_depth)
+		total->max_depth = src->max_depth;
+	for(n = 0; n <= MAX_N; n++)
+		total->branching[n] += src->branching[n];
+	total->propagated += src->propagated;
+	total->eliminated += src->eliminated;
+	total->pick_ticks += src->pick_ticks;
+	total->change_ticks += src->change_ticks;
+	total->propagate_ticks += src->propagate_ticks;
+	total->timeouts += src->timeouts;
+	total->restarts += src->restarts;
+	total->requeued += src->requeued;
+	total->solutions += src->solutions;
+	for(n = 0; n < PROFILE_EVENTS; n++)
+		total->counters[n] += src->counters[n];
+}
+
+/*
+	Takes src back out of total (but for max_depth), when a search counted once goes on elsewhere.
+*/
+void sub_stats(solver_stats * total, const solver_stats * src)
+{
+	int n;
+	total->nodes -= src->nodes;
+	total->backtracks -= src->backtracks;
+	for(n = 0; n <= MAX_N; n++)
+		total->branching[n] -= src->branching[n];
+	total->propagated -= src->propagated;
+	total->eliminated -= src->eliminated;
+	total->pick_ticks -= src->pick_ticks;
+	total->change_ticks -= src->change_ticks;
+	total->propagate_ticks -= src->propagate_ticks;
+	total->timeouts -= src->timeouts;
+	total->restarts -= src->restarts;
+	total->requeued -= src->requeued;
+	total->solutions -= src->solutions;
+	for(n = 0; n < PROFILE_EVENTS; n++)
+		total->counters[n] -= src->counters[n];
+}
+
+/*
+	Writes the statistics on one line: backtracks (first, so that the line still sorts and
+	plots like a plain backtrack count), nodes, max_depth, propagated, eliminated, pick_ticks,
+	change_ticks, propagate_ticks, then the branching histogram from 0 to max_n hypothesis.
+*/
+int sprint_stats(const solver_stats * st, int max_n, char * out)
+{
+	char * start = out;
+	int n;
+	out += sprintf(out, "%lld %lld %d %lld %lld %llu %llu %llu", st->backtracks, st->nodes, st->max_depth,
+		st->propagated, st->eliminated, st->pick_ticks, st->change_ticks, st->propagate_ticks);
+	for(n = 0; n <= max_n; n++)
+		out += sprintf(out, " %lld", st->branching[n]);
+	*out++ = '\n';
+	return out - start;
+}
+
+/*
+	Prints the totals of a whole run, one statistic per line; the branching histogram goes
+	up to the largest board solved (max_n).
+*/
+void fprint_summary(FILE * f, long npuzzles, int max_n, const solver_stats * st)
+{
+	int n;
+	fprintf(f, "puzzles %ld\nsolutions %lld\ntimeouts %lld\nrequeued %lld\nrestarts %lld\nbacktracks %lld\nnodes %lld\nmax_depth %d\npropagated %lld\neliminated %lld\n"
+		"pick_ticks %llu\nchange_ticks %llu\npropagate_ticks %llu\nbranching", npuzzles, st->solutions, st->timeouts, st->requeued, st->restarts, st->backtracks, st->nodes,
+		st->max_depth, st->propagated, st->eliminated, st->pick_ticks, st->change_ticks, st->propagate_ticks);
+	for(n = 0; n <= max_n; n++)
+		fprintf(f, " %lld", st->branching[n]);
+	fprintf(f, "\n");
+}
+
+/*
+	Writes the hardware counters of one solve on a line, for --output=profile: cycles,
+	instructions, branch-misses, l1d-misses and llc-misses of the whole solve, then the three
+	phase timings of sprint_stats (pick_ticks, change_ticks, propagate_ticks), which count
+	the event of --phase-counter instead of clock ticks when it is given.
+*/
+int sprint_profile(const solver_stats * st, char * out)
+{
+	char * start = out;
+	int e;
+	for(e = 0; e < PROFILE_EVENTS; e++)
+		out += sprintf(out, "%llu ", st->counters[e]);
+	out += sprintf(out, "%llu %llu %llu\n", st->pick_ticks, st->change_ticks, st->propagate_ticks);
+	return out - start;
+}
+
+/*
+	Prints the hardware counters of a whole run, after fprint_summary: one per line, then the
+	instructions per cycle and the events per thousand instructions.
+*/
+void fprint_profile(FILE * f, const solver_stats * st)
+{
+	int e;
+	unsigned long long kilo = st->counters[1] / 1000;
+	for(e = 0; e < PROFILE_EVENTS; e++)
+		fprintf(f, "%s %llu\n", profile_event_names[e], st->counters[e]);
+	if (st->counters[0])
+		fprintf(f, "instructions_per_cycle %.3f\n", (double) st->counters[1] / st->counters[0]);
+	for(e = 2; e < PROFILE_EVENTS && kilo; e++)
+		fprintf(f, "%s_per_kilo_instruction %.3f\n", profile_event_names[e], (double) st->counters[e] / kilo);
+}
+
+/*
+	Work-stealing deques of the parallel search (see bitsudoku.inc), shared by all sizes.
+*/
+
+#define MAX_SPLIT_DEPTH 8
+#define DEFAULT_SPLIT_DEPTH 3
+// outstanding tasks per deque: up to MAX_N siblings at each level above the one being run
+#define DEQUE_SIZE (MAX_N * (MAX_SPLIT_DEPTH + 1))
+
+typedef struct {
+	int depth;
+	unsigned short cell[MAX_SPLIT_DEPTH];
+	unsigned char number[MAX_SPLIT_DEPTH];
+} search_task;
+
+typedef struct {
+	search_task tasks[DEQUE_SIZE];	// used as a ring: tasks[top % DEQUE_SIZE] .. tasks[(bottom-1) % DEQUE_SIZE]
+	long top, bottom;
+	pthread_mutex_t lock;
+} CACHE_ALIGNED task_deque;
+
+void push_task(task_deque * d, const search_task * t)
+{
+	pthread_mutex_lock(&d->lock);
+	assert(d->bottom - d->top < DEQUE_SIZE);
+	d->tasks[d->bottom % DEQUE_SIZE] = *t;
+	d->bottom++;
+	pthread_mutex_unlock(&d->lock);
+}
+
+// from_top = 0 for the owner of the deque, 1 for thieves. Returns 0 if the deque was empty.
+int pop_task(task_deque * d, search_task * t, int from_top)
+{
+	int found = 0;
+	pthread_mutex_lock(&d->lock);
+	if (d->bottom > d->top)
+		{
+			if (from_top)
+				*t = d->tasks[d->top++ % DEQUE_SIZE];
+			else
+				*t = d->tasks[--d->bottom % DEQUE_SIZE];
+			found = 1;
+		}
+	pthread_mutex_unlock(&d->lock);
+	return found;
+}
+
+typedef struct solution_cache solution_cache;
+
+// How to solve puzzles, as given on the command line
+typedef struct {
+	enum engine_type engine;
+	enum propagation_level propagation;
+	int search_threads;		// threads searching each puzzle (bitmask engine only)
+	int split_depth;		// levels of the search tree split into tasks for those threads
+	enum output_format output;
+	enum backtrack_mode backtrack;	// how the bitmask engine rolls back a failed branch
+	long long max_nodes;	// bitmask engine: give up a puzzle after that many nodes (0: never)
+	double max_time;		// bitmask engine: give up a puzzle after that many milliseconds of search (0: never)
+	int count_limit;		// --output=count stops counting the solutions of a puzzle there
+	int cache_size;			// entries of the cache (0: no cache)
+	solution_cache * cache;	// made from cache_size, shared by all threads
+	// branching heuristics of the bitmask engine (see bit_solve_guided)
+	enum cell_order cell_order;		// tie-break between the cells with the fewest hypothesis
+	enum value_order value_order;	// order of the numbers tried at a cell
+	enum branch_type branching;		// a cell, or the places of a number in a unit, whichever has fewer options
+	long long restart_nodes;		// nodes of the first randomized run before starting over (0: no restarts)
+	int resumable;			// a search given up stays where it stopped (for the slow lane) instead of rolling back
+	int profile;			// count the hardware events of every solve (see profile_counters)
+	int phase_event;		// 1 + event of profile_event_names the phase timings count, 0 for clock ticks
+	int lane_depth;			// SIMD engine: levels of search in the vector lanes (see lane_search)
+} solver_options;
+
+#define MAX_LANE_DEPTH 3
+
+const solver_options default_options = { BITMASK_ENGINE, SINGLES_PROPAGATION, 1, DEFAULT_SPLIT_DEPTH, GRID_OUTPUT, UNDO_BACKTRACK, 0, 0, 2, 0, NULL,
+	FIRST_CELL, ASCENDING_VALUES, CELL_BRANCHING, 0, 0, 0, 0, 0 };
+
+/*
+	Applies arg if it is one of the options of how to solve puzzles (see the usage above).
+	Returns 0 if it is not.
+*/
+int parse_solver_option(solver_options * opt, const char * arg)
+{
+	if (strcmp(arg, "--engine=bitmask") == 0)
+		opt->engine = BITMASK_ENGINE;
+	else if (strcmp(arg, "--engine=counter") == 0)
+		opt->engine = COUNTER_ENGINE;
+	else if (strcmp(arg, "--engine=simd") == 0)
+		opt->engine = SIMD_ENGINE;
+	else if (strcmp(arg, "--engine=dlx") == 0)
+		opt->engine = DLX_ENGINE;
+	else if (strcmp(arg, "--propagate=none") == 0)
+		opt->propagation = NO_PROPAGATION;
+	else if (strcmp(arg, "--propagate=singles") == 0)
+		opt->propagation = SINGLES_PROPAGATION;
+	else if (strcmp(arg, "--propagate=full") == 0)
+		opt->propagation = FULL_PROPAGATION;
+	else if (strcmp(arg, "--backtrack=undo") == 0)
+		opt->backtrack = UNDO_BACKTRACK;
+	else if (strcmp(arg, "--backtrack=copy") == 0)
+		opt->backtrack = COPY_BACKTRACK;
+	else if (strcmp(arg, "--backtrack=iterative") == 0)
+		opt->backtrack = ITERATIVE_BACKTRACK;
+	else if (strncmp(arg, "--max-nodes=", 12) == 0)
+		opt->max_nodes = atoll(arg + 12);
+	else if (strncmp(arg, "--max-time=", 11) == 0)
+		opt->max_time = atof(arg + 11);
+	else if (strcmp(arg, "--output=grid") == 0)
+		opt->output = GRID_OUTPUT;
+	else if (strcmp(arg, "--output=linear") == 0)
+		opt->output = LINEAR_OUTPUT;
+	else if (strcmp(arg, "--output=stats") == 0)
+		opt->output = STATS_OUTPUT;
+	else if (strcmp(arg, "--output=count") == 0)
+		opt->output = COUNT_OUTPUT;
+	else if (strcmp(arg, "--output=rating") == 0)
+		opt->output = RATING_OUTPUT;
+	else if (strcmp(arg, "--output=profile") == 0)
+		{
+			opt->output = PROFILE_OUTPUT;
+			opt->profile = 1;
+		}
+	else if (strncmp(arg, "--count-limit=", 14) == 0)
+		opt->count_limit = atoi(arg + 14);
+	else if (strncmp(arg, "--cache=", 8) == 0)
+		opt->cache_size = atoi(arg + 8);
+	else if (strncmp(arg, "--search-threads=", 17) == 0)
+		opt->search_threads = atoi(arg + 17);
+	else if (strncmp(arg, "--split-depth=", 14) == 0)
+		opt->split_depth = atoi(arg + 14);
+	else if (strcmp(arg, "--cell-order=first") == 0)
+		opt->cell_order = FIRST_CELL;
+	else if (strcmp(arg, "--cell-order=degree") == 0)
+		opt->cell_order = DEGREE_CELL;
+	else if (strcmp(arg, "--value-order=ascending") == 0)
+		opt->value_order = ASCENDING_VALUES;
+	else if (strcmp(arg, "--value-order=lcv") == 0)
+		opt->value_order = LCV_VALUES;
+	else if (strcmp(arg, "--branch=cell") == 0)
+		opt->branching = CELL_BRANCHING;
+	else if (strcmp(arg, "--branch=unit") == 0)
+		opt->branching = UNIT_BRANCHING;
+	else if (strncmp(arg, "--restarts=", 11) == 0)
+		opt->restart_nodes = atoll(arg + 11);
+	else if (strncmp(arg, "--lane-depth=", 13) == 0)
+		opt->lane_depth = atoi(arg + 13);
+	else if (strcmp(arg, "--profile") == 0)
+		opt->profile = 1;
+	else if (strncmp(arg, "--phase-counter=", 16) == 0)
+		{
+			for(opt->phase_event = PROFILE_EVENTS; opt->phase_event > 0; opt->phase_event--)
+				if (strcmp(arg + 16, profile_event_names[opt->phase_event - 1]) == 0)
+					break;
+			if (opt->phase_event == 0)
+				opt->phase_event = -1;
+		}
+	else
+		return 0;
+	return 1;
+}
+
+/*
+	Whether the search uses bit_solve_guided rather than the plain bitmask search.
+*/
+int guided_search(const solver_options * opt)
+{
+	return opt->cell_order != FIRST_CELL || opt->value_order != ASCENDING_VALUES || opt->branching != CELL_BRANCHING
+		|| opt->restart_nodes != 0;
+}
+
+int valid_options(const solver_options * opt)
+{
+	// the heuristics only exist in the recursive undo search
+	int guided = guided_search(opt) && (opt->engine == BITMASK_ENGINE || opt->engine == SIMD_ENGINE);
+	return opt->search_threads >= 1 && opt->split_depth >= 1 && opt->split_depth <= MAX_SPLIT_DEPTH && opt->max_nodes >= 0
+		&& opt->max_time >= 0 && opt->count_limit >= 1 && !(opt->output == COUNT_OUTPUT && opt->engine == COUNTER_ENGINE) && opt->cache_size >= 0
+		&& opt->restart_nodes >= 0 && !(guided && (opt->search_threads > 1 || opt->max_nodes || opt->max_time || opt->backtrack != UNDO_BACKTRACK
+			|| opt->output == COUNT_OUTPUT))
+		// the counters only see the thread that opened them (and ratings are solved with options of their own),
+		// and the phases are only timed with SOLVER_STATS=2
+		&& !((opt->profile || opt->phase_event) && (opt->search_threads > 1 || opt->output == RATING_OUTPUT)) && opt->phase_event >= 0
+		&& !(opt->phase_event && SOLVER_STATS < 2)
+		// the lanes only run the default search of the SIMD engine, and cannot tell a second solution
+		&& opt->lane_depth >= 0 && opt->lane_depth <= MAX_LANE_DEPTH && !(opt->lane_depth && (opt->engine != SIMD_ENGINE
+			|| opt->propagation != SINGLES_PROPAGATION || opt->output == COUNT_OUTPUT || guided_search(opt)));
+}
+
+/*
+	The bitmask engine of one board size, as built by bitsudoku.inc.
+*/
+typedef struct {
+	int box_size;
+	size_t board_bytes;		// sizeof its bitsudoku
+	size_t hot_bytes;		// of the board itself, without the undo information (BOARD_BYTES)
+	solver_stats * (*run)(const solver_options * opt, void * board, puzzle * p);
+	solver_stats * (*resume)(const solver_options * opt, void * board);	// goes on with a search run gave up
+	int (*sprint)(void * board, enum print_mode mode, char * out);
+} board_kind;
+
+#define BOX_SIZE 2
+#define BOARD_SIZE 4
+#include "bitsudoku.inc"
+#undef BOARD_SIZE
+#undef BOX_SIZE
+
+#define BOX_SIZE 3
+#define BOARD_SIZE 9
+#include "bitsudoku.inc"
+#undef BOARD_SIZE
+#undef BOX_SIZE
+
+#define BOX_SIZE 4
+#define BOARD_SIZE 16
+#include "bitsudoku.inc"
+#undef BOARD_SIZE
+#undef BOX_SIZE
+
+#define BOX_SIZE 5
+#define BOARD_SIZE 25
+#include "bitsudoku.inc"
+#undef BOARD_SIZE
+#undef BOX_SIZE
+
+// indexed by box size
+const board_kind * board_kinds[MAX_SQRT_N + 1] = { NULL, NULL, &bit_kind_4, &bit_kind_9, &bit_kind_16, &bit_kind_25 };
+
+/*
+	Dancing links engine (Knuth's Algorithm X).
+	A puzzle is an exact cover problem: every cell, and every number in every row, column
+	and box, must be covered by exactly one of the rows (cell, number) chosen. The search
+	branches on the constraint with the fewest rows left, be it a cell or a number in a
+	unit, and removes (covers) the columns of a chosen row by unlinking them from the
+	matrix, then links them back in reverse order when it backtracks.
+	The matrix of a board size is built once, in a preallocated pool: the column headers
+	first, then the 4 nodes of each row next to each other, so that the horizontal links
+	never change and need not be stored. A puzzle covers the rows of its givens before the
+	search, and uncovers them after it, leaving the matrix ready for the next puzzle.
+*/
+
+#define DLX_MAX_COLUMNS (4 * MAX_N * MAX_N)
+#define DLX_MAX_NODES (DLX_MAX_COLUMNS + 4 * MAX_N * MAX_N * MAX_N)
+
+typedef struct {
+	int up, down;
+	int column;
+} dlx_node;
+
+typedef struct {
+	int box_size;		// of the board the matrix is built for, 0 before the first puzzle
+	int ncolumns;
+	dlx_node node[DLX_MAX_NODES];	// column headers, then 4 nodes for row cell*n + number
+	int size[DLX_MAX_COLUMNS];		// rows left in each column
+	int prev[DLX_MAX_COLUMNS + 1], next[DLX_MAX_COLUMNS + 1];	// uncovered columns; the list head is at ncolumns
+	int chosen[MAX_N * MAX_N];		// row chosen at each level of the search
+	int nchosen;
+	int depth;
+	puzzle board;		// the puzzle, then its first solution
+	solver_stats stats;
+} dlx;
+
+// the node after (step 1) or before (step 3) node i in its row
+static inline int dlx_beside(const dlx * d, int i, int step)
+{
+	int first = i - (i - d->ncolumns) % 4;
+	return first + (i - first + step) % 4;
+}
+
+void dlx_build(dlx * d, int box_size)
+{
+	int n = box_size * box_size, ncolumns = 4*n*n;
+	int c, r, k;
+	d->box_size = box_size;
+	d->ncolumns = ncolumns;
+	for(c = 0; c < ncolumns; c++)
+		{
+			d->node[c].up = d->node[c].down = d->node[c].column = c;
+			d->size[c] = 0;
+		}
+	for(c = 0; c <= ncolumns; c++)
+		{
+			d->prev[c] = c == 0 ? ncolumns : c - 1;
+			d->next[c] = c == ncolumns ? 0 : c + 1;
+		}
+	for(r = 0; r < n*n*n; r++)
+		{
+			int cell = r / n, number = r % n, row = cell / n, col = cell % n;
+			int box = (row / box_size) * box_size + col / box_size;
+			int columns[4] = { cell, n*n + row*n + number, 2*n*n + col*n + number, 3*n*n + box*n + number };
+			for(k = 0; k < 4; k++)
+				{
+					int i = ncolumns + 4*r + k;
+					c = columns[k];
+					d->node[i].column = c;
+					d->node[i].up = d->node[c].up;
+					d->node[i].down = c;
+					d->node[d->node[c].up].down = i;
+					d->node[c].up = i;
+					d->size[c]++;
+				}
+		}
+}
+
+void dlx_cover(dlx * d, int c)
+{
+	int i, j;
+	d->next[d->prev[c]] = d->next[c];
+	d->prev[d->next[c]] = d->prev[c];
+	for(i = d->node[c].down; i != c; i = d->node[i].down)
+		for(j = dlx_beside(d, i, 1); j != i; j = dlx_beside(d, j, 1))
+			{
+				d->node[d->node[j].up].down = d->node[j].down;
+				d->node[d->node[j].down].up = d->node[j].up;
+				d->size[d->node[j].column]--;
+			}
+}
+
+void dlx_uncover(dlx * d, int c)
+{
+	int i, j;
+	for(i = d->node[c].up; i != c; i = d->node[i].up)
+		for(j = dlx_beside(d, i, 3); j != i; j = dlx_beside(d, j, 3))
+			{
+				d->size[d->node[j].column]++;
+				d->node[d->node[j].up].down = j;
+				d->node[d->node[j].down].up = j;
+			}
+	d->next[d->prev[c]] = c;
+	d->prev[d->next[c]] = c;
+}
+
+// covers the other columns of the row of node i (its own column is already covered)
+void dlx_choose(dlx * d, int i)
+{
+	int j;
+	d->chosen[d->nchosen++] = (i - d->ncolumns) / 4;
+	for(j = dlx_beside(d, i, 1); j != i; j = dlx_beside(d, j, 1))
+		dlx_cover(d, d->node[j].column);
+}
+
+void dlx_unchoose(dlx * d, int i)
+{
+	int j;
+	for(j = dlx_beside(d, i, 3); j != i; j = dlx_beside(d, j, 3))
+		dlx_uncover(d, d->node[j].column);
+	d->nchosen--;
+}
+
+/*
+	Counts the exact covers left, up to limit, copying the first one into d->board.
+	The matrix is back as it was when it returns.
+*/
+int dlx_search(dlx * d, int limit)
+{
+	int root = d->ncolumns, c, i, best = -1;
+	d->stats.nodes++;
+	if (d->next[root] == root)
+		{
+			if (d->stats.solutions++ == 0)
+				for(i = 0; i < d->nchosen; i++)
+					d->board.cell[d->chosen[i] / (d->box_size * d->box_size)] = d->chosen[i] % (d->box_size * d->box_size);
+			return 1;
+		}
+
+	// the column with the fewest rows; 0 or 1 cannot be beaten
+	TIME_STAT(unsigned long long start = read_ticks());
+	for(c = d->next[root]; c != root; c = d->next[c])
+		if (best < 0 || d->size[c] < d->size[best])
+			{
+				best = c;
+				if (d->size[c] <= 1)
+					break;
+			}
+	TIME_STAT(d->stats.pick_ticks += read_ticks() - start);
+	STAT(d->stats.branching[d->size[best]]++);
+	if (d->size[best] == 0)
+		{
+			d->stats.backtracks++;
+			return 0;
+		}
+
+	STAT(if (++d->depth > d->stats.max_depth) d->stats.max_depth = d->depth);
+	int count = 0;
+	dlx_cover(d, best);
+	for(i = d->node[best].down; i != best && count < limit; i = d->node[i].down)
+		{
+			dlx_choose(d, i);
+			count += dlx_search(d, limit - count);
+			dlx_unchoose(d, i);
+		}
+	dlx_uncover(d, best);
+	STAT(d->depth--);
+	return count;
+}
+
+/*
+	Solves p (or counts its solutions with --output=count). --propagate, --backtrack,
+	--max-nodes and --search-threads do not apply.
+*/
+solver_stats * dlx_run(const solver_options * opt, dlx * d, puzzle * p)
+{
+	int n = p->box_size * p->box_size, i, ngiven = 0;
+	int given[MAX_N * MAX_N];		// a node of the row of each given
+
+	if (d->box_size != p->box_size)
+		dlx_build(d, p->box_size);
+	memset(&d->stats, 0, sizeof(solver_stats));
+	d->nchosen = 0;
+	d->depth = 0;
+	d->board = *p;
+
+	for(i = 0; i < n*n; i++)
+		if (p->cell[i] != EMPTY_CELL)
+			{
+				int node = d->ncolumns + 4*(i*n + p->cell[i]);
+				dlx_cover(d, d->node[node].column);
+				dlx_choose(d, node);
+				given[ngiven++] = node;
+			}
+	dlx_search(d, opt->output == COUNT_OUTPUT ? opt->count_limit : 1);
+	while(ngiven > 0)
+		{
+			int node = given[--ngiven];
+			dlx_unchoose(d, node);
+			dlx_uncover(d, d->node[node].column);
+		}
+	return &d->stats;
+}
+
+/*
+	Writes a board as the VALUE or LINEAR_VALUE modes of print() do, with * for empty cells.
+*/
+int sprint_board(const puzzle * p, enum print_mode mode, char * out)
+{
+	char * start = out;
+	int n = p->box_size * p->box_size;
+	int i,j;
+	for(i = 0; i < n; i++)
+		{
+			for(j = 0; j < n; j++)
+				*out++ = p->cell[i*n + j] == EMPTY_CELL ? '*' : digit_symbols[p->cell[i*n + j] + 1];
+			if (mode == VALUE)
+				*out++ = '\n';
+		}
+	*out++ = '\n';
+	return out - start;
+}
+
+/*
+	Solution cache.
+	Puzzles are looked up by a canonical form, the same for a puzzle and its isomorphs
+	(numbers relabelled, rows swapped inside a band, bands swapped, the same for columns
+	and stacks, and the board transposed), so that they share one entry.
+
+	The rows, columns, numbers and boxes of a puzzle first get keys that do not depend on
+	how it is written: starting from nothing, each key is hashed CANON_ROUNDS times with the
+	keys of the lines, numbers and boxes it meets at the givens. The bands are then sorted
+	by the keys of their rows, the rows of each band by their own keys, and the same for
+	stacks and columns, both ways round (transposed or not); the numbers are relabelled in
+	order of first appearance, and the smaller of the two boards is the canonical form.
+	Lines with equal keys keep their order, so a few isomorphs may get different forms and
+	miss each other in the cache, but a puzzle always finds the entry of its exact repeats.
+
+	The cache keeps the canonical form of the solution (mapped back to each puzzle that hits
+	it) and the statistics of the search that found it. It is a hash table split into
+	CACHE_SHARDS shards, each with its own lock, its own share of the entries and its own
+	least recently used list, which gives up its oldest entry when the shard is full.
+*/
+
+#define CANON_ROUNDS 3
+#define CACHE_SHARDS 16
+
+// how a puzzle maps to its canonical form
+typedef struct {
+	int transposed;
+	unsigned char row[MAX_N], col[MAX_N];	// line of the puzzle at each line of the canonical form
+	signed char number[MAX_N];				// number of the puzzle for each number of the canonical form
+} canon_map;
+
+static inline unsigned long long mix(unsigned long long x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	return x ^ (x >> 33);
+}
+
+// same value for (a, b) and (b, a): a row and a column change roles in a transposition
+static inline unsigned long long mix_pair(unsigned long long a, unsigned long long b)
+{
+	return mix(mix(a) + mix(b));
+}
+
+/*
+	Sorts the n lines of a band or stack structure by key: the bands (or stacks) by the sum
+	of the keys of their lines, then the lines inside each. order gets the lines in sorted
+	order. Equal keys keep their order.
+*/
+void sort_lines(const unsigned long long * key, int box_size, unsigned char * order)
+{
+	unsigned long long band_key[MAX_SQRT_N];
+	int band[MAX_SQRT_N];
+	int i, j, k;
+	for(i = 0; i < box_size; i++)
+		{
+			band[i] = i;
+			band_key[i] = 0;
+			for(k = 0; k < box_size; k++)
+				band_key[i] += mix(key[i*box_size + k]);
+		}
+	for(i = 1; i < box_size; i++)
+		for(j = i; j > 0 && band_key[band[j]] < band_key[band[j-1]]; j--)
+			{
+				int t = band[j]; band[j] = band[j-1]; band[j-1] = t;
+			}
+	for(i = 0; i < box_size; i++)
+		{
+			unsigned char * line = order + i*box_size;
+			for(k = 0; k < box_size; k++)
+				line[k] = band[i]*box_size + k;
+			for(k = 1; k < box_size; k++)
+				for(j = k; j > 0 && key[line[j]] < key[line[j-1]]; j--)
+					{
+						unsigned char t = line[j]; line[j] = line[j-1]; line[j-1] = t;
+					}
+		}
+}
+
+/*
+	Writes the canonical form of p to key, and how p maps to it to m.
+*/
+void canonicalize(const puzzle * p, puzzle * key, canon_map * m)
+{
+	int b = p->box_size, n = b*b;
+	unsigned long long rk[MAX_N] = { 0 }, ck[MAX_N] = { 0 }, dk[MAX_N] = { 0 }, bk[MAX_N] = { 0 };
+	int i, j, r, t;
+
+	for(r = 0; r < CANON_ROUNDS; r++)
+		{
+			unsigned long long nr[MAX_N], nc[MAX_N], nd[MAX_N], nb[MAX_N];
+			for(i = 0; i < n; i++)
+				{
+					nr[i] = mix(rk[i]);
+					nc[i] = mix(ck[i]);
+					nd[i] = mix(dk[i] + 1);
+					nb[i] = mix(bk[i] + 2);
+				}
+			for(i = 0; i < n; i++)
+				for(j = 0; j < n; j++)
+					{
+						int d = p->cell[i*n + j], box = (i / b) * b + j / b;
+						if (d == EMPTY_CELL)
+							continue;
+						nr[i] += mix(ck[j] ^ mix(dk[d] ^ mix(bk[box])));
+						nc[j] += mix(rk[i] ^ mix(dk[d] ^ mix(bk[box])));
+						nd[d] += mix(mix_pair(rk[i], ck[j]) ^ mix(bk[box] + 3));
+						nb[box] += mix(mix_pair(rk[i], ck[j]) ^ mix(dk[d] + 4));
+					}
+			memcpy(rk, nr, sizeof(rk));
+			memcpy(ck, nc, sizeof(ck));
+			memcpy(dk, nd, sizeof(dk));
+			memcpy(bk, nb, sizeof(bk));
+		}
+
+	// the board read both ways round, keeping the smaller
+	for(t = 0; t < 2; t++)
+		{
+			puzzle form;
+			canon_map map;
+			signed char label[MAX_N];		// number of the form for each number of p
+			int nlabels = 0, d;
+			map.transposed = t;
+			sort_lines(t ? ck : rk, b, map.row);
+			sort_lines(t ? rk : ck, b, map.col);
+			memset(label, EMPTY_CELL, sizeof(label));
+			form.box_size = b;
+			for(i = 0; i < n; i++)
+				for(j = 0; j < n; j++)
+					{
+						d = t ? p->cell[map.col[j]*n + map.row[i]] : p->cell[map.row[i]*n + map.col[j]];
+						if (d != EMPTY_CELL && label[d] == EMPTY_CELL)
+							{
+								map.number[nlabels] = d;
+								label[d] = nlabels++;
+							}
+						form.cell[i*n + j] = d == EMPTY_CELL ? EMPTY_CELL : label[d];
+					}
+			for(d = 0; d < n; d++)		// numbers missing from p take the labels left, in order
+				if (label[d] == EMPTY_CELL)
+					map.number[nlabels++] = d;
+			if (t == 0 || memcmp(form.cell, key->cell, n*n) < 0)
+				{
+					*key = form;
+					*m = map;
+				}
+		}
+}
+
+// the cell of the puzzle at cell k of its canonical form
+static inline int canon_cell(const canon_map * m, int n, int k)
+{
+	int i = m->row[k / n], j = m->col[k % n];
+	return m->transposed ? j*n + i : i*n + j;
+}
+
+/*
+	Maps a board of the canonical form of a puzzle back to the puzzle (from_canon) or the
+	other way (to_canon), empty cells included.
+*/
+void from_canon(const canon_map * m, const puzzle * form, puzzle * p)
+{
+	int n = form->box_size * form->box_size, k;
+	p->box_size = form->box_size;
+	for(k = 0; k < n*n; k++)
+		p->cell[canon_cell(m, n, k)] = form->cell[k] == EMPTY_CELL ? EMPTY_CELL : m->number[(int) form->cell[k]];
+}
+
+void to_canon(const canon_map * m, const puzzle * p, puzzle * form)
+{
+	int n = p->box_size * p->box_size, k;
+	signed char label[MAX_N];
+	for(k = 0; k < n; k++)
+		label[(int) m->number[k]] = k;
+	form->box_size = p->box_size;
+	for(k = 0; k < n*n; k++)
+		{
+			int d = p->cell[canon_cell(m, n, k)];
+			form->cell[k] = d == EMPTY_CELL ? EMPTY_CELL : label[d];
+		}
+}
+
+typedef struct cache_entry {
+	puzzle key;				// canonical form of the puzzle
+	puzzle solution;		// canonical form of the board printed for it
+	solver_stats stats;
+	unsigned long long hash;
+	struct cache_entry * chain;				// next entry of the same bucket
+	struct cache_entry * newer, * older;	// least recently used list of the shard
+} cache_entry;
+
+typedef struct {
+	pthread_mutex_t lock;
+	cache_entry ** buckets;
+	int nbuckets;			// a power of 2
+	cache_entry * entries;
+	int nentries, capacity;
+	cache_entry * newest, * oldest;
+	long long hits, misses;
+} CACHE_ALIGNED cache_shard;
+
+struct solution_cache {
+	cache_shard shards[CACHE_SHARDS];
+};
+
+/*
+	Returns a cache of about capacity entries (at least one per shard).
+*/
+solution_cache * new_cache(int capacity)
+{
+	solution_cache * c = alloc_aligned(sizeof(solution_cache));
+	int i;
+	assert(c != NULL);
+	for(i = 0; i < CACHE_SHARDS; i++)
+		{
+			cache_shard * sh = &c->shards[i];
+			pthread_mutex_init(&sh->lock, NULL);
+			sh->capacity = (capacity + CACHE_SHARDS - 1) / CACHE_SHARDS;
+			for(sh->nbuckets = 1; sh->nbuckets < 2 * sh->capacity; sh->nbuckets *= 2)
+				;
+			sh->buckets = calloc(sh->nbuckets, sizeof(cache_entry *));
+			sh->entries = malloc(sh->capacity * sizeof(cache_entry));
+			assert(sh->buckets != NULL && sh->entries != NULL);
+			sh->nentries = 0;
+			sh->newest = sh->oldest = NULL;
+			sh->hits = sh->misses = 0;
+		}
+	return c;
+}
+
+void free_cache(solution_cache * c)
+{
+	int i;
+	for(i = 0; i < CACHE_SHARDS; i++)
+		{
+			pthread_mutex_destroy(&c->shards[i].lock);
+			free(c->shards[i].buckets);
+			free(c->shards[i].entries);
+		}
+	free(c);
+}
+
+unsigned long long hash_form(const puzzle * form)
+{
+	int n = form->box_size * form->box_size, k;
+	unsigned long long h = form->box_size;
+	for(k = 0; k < n*n; k++)
+		h = mix(h + (unsigned char) form->cell[k]);
+	return h;
+}
+
+static void unlink_lru(cache_shard * sh, cache_entry * e)
+{
+	if (e->newer) e->newer->older = e->older; else sh->newest = e->older;
+	if (e->older) e->older->newer = e->newer; else sh->oldest = e->newer;
+}
+
+static void push_lru(cache_shard * sh, cache_entry * e)
+{
+	e->newer = NULL;
+	e->older = sh->newest;
+	if (sh->newest) sh->newest->newer = e; else sh->oldest = e;
+	sh->newest = e;
+}
+
+// the entry of form in its shard, or NULL (the shard must be locked)
+static cache_entry * find_entry(cache_shard * sh, const puzzle * form, unsigned long long hash)
+{
+	int n = form->box_size * form->box_size;
+	cache_entry * e;
+	for(e = sh->buckets[hash & (sh->nbuckets - 1)]; e; e = e->chain)
+		if (e->hash == hash && e->key.box_size == form->box_size && memcmp(e->key.cell, form->cell, n*n) == 0)
+			return e;
+	return NULL;
+}
+
+/*
+	Copies the solution and statistics cached for the canonical form into solution and stats.
+	Returns 0 (a miss) if it is not there.
+*/
+int cache_lookup(solution_cache * c, const puzzle * form, puzzle * solution, solver_stats * stats)
+{
+	unsigned long long hash = hash_form(form);
+	cache_shard * sh = &c->shards[hash % CACHE_SHARDS];
+	pthread_mutex_lock(&sh->lock);
+	cache_entry * e = find_entry(sh, form, hash);
+	if (e)
+		{
+			*solution = e->solution;
+			*stats = e->stats;
+			unlink_lru(sh, e);
+			push_lru(sh, e);
+			sh->hits++;
+		}
+	else
+		sh->misses++;
+	pthread_mutex_unlock(&sh->lock);
+	return e != NULL;
+}
+
+/*
+	Adds the solution and statistics of a canonical form, in place of the least recently
+	used entry of its shard if it is full.
+*/
+void cache_insert(solution_cache * c, const puzzle * form, const puzzle * solution, const solver_stats * stats)
+{
+	unsigned long long hash = hash_form(form);
+	cache_shard * sh = &c->shards[hash % CACHE_SHARDS];
+	cache_entry * e, ** link;
+	pthread_mutex_lock(&sh->lock);
+	if (find_entry(sh, form, hash))		// another thread solved it meanwhile
+		{
+			pthread_mutex_unlock(&sh->lock);
+			return;
+		}
+	if (sh->nentries < sh->capacity)
+		e = &sh->entries[sh->nentries++];
+	else
+		{
+			e = sh->oldest;
+			unlink_lru(sh, e);
+			for(link = &sh->buckets[e->hash & (sh->nbuckets - 1)]; *link != e; link = &(*link)->chain)
+				;
+			*link = e->chain;
+		}
+	e->key = *form;
+	e->solution = *solution;
+	e->stats = *stats;
+	e->hash = hash;
+	e->chain = sh->buckets[hash & (sh->nbuckets - 1)];
+	sh->buckets[hash & (sh->nbuckets - 1)] = e;
+	push_lru(sh, e);
+	pthread_mutex_unlock(&sh->lock);
+}
+
+void fprint_cache(FILE * f, solution_cache * c)
+{
+	long long hits = 0, misses = 0;
+	int i;
+	for(i = 0; i < CACHE_SHARDS; i++)
+		{
+			pthread_mutex_lock(&c->shards[i].lock);
+			hits += c->shards[i].hits;
+			misses += c->shards[i].misses;
+			pthread_mutex_unlock(&c->shards[i].lock);
+		}
+	fprintf(f, "cache_hits %lld\ncache_misses %lld\n", hits, misses);
+}
+
+/*
+	Everything needed to solve puzzles one after the other; each thread owns one.
+*/
+typedef struct {
+	sudoku s;
+	void * boards[MAX_SQRT_N + 1];	// a bitsudoku of each size, allocated when first needed
+	dlx * exact;			// allocated when first needed
+	int cached;				// the last puzzle was found in the cache
+	puzzle hit;				// its board, when it was
+	solver_stats hit_stats;
+	solver_stats total;		// everything solved with this state so far
+	long npuzzles;
+	int max_n;				// largest board solved so far
+	// batch mode with a slow lane: takes over the board of a search given up (see requeue_timeout)
+	void (*requeue)(void * arg, void * board, int box_size, char * out);
+	void * requeue_arg;
+	int profiling;			// profile is open, with --profile
+	profile_counters profile;
+	struct lane_tree * trees;	// of lane_search, allocated when first needed
+} CACHE_ALIGNED solver_state;
+
+void new_solver_state(solver_state * st)
+{
+	memset(&st->total, 0, sizeof(solver_stats));
+	memset(st->boards, 0, sizeof(st->boards));
+	st->exact = NULL;
+	st->cached = 0;
+	st->npuzzles = 0;
+	st->max_n = N;
+	st->requeue = NULL;
+	st->profiling = 0;
+	st->trees = NULL;
+}
+
+void free_solver_state(solver_state * st)
+{
+	int b;
+	for(b = 0; b <= MAX_SQRT_N; b++)
+		free(st->boards[b]);
+	free(st->exact);
+	free(st->trees);
+	if (st->profiling)
+		close_profile(&st->profile);
+}
+
+/*
+	Reads the counters of --profile into before, opening them with the first puzzle of st.
+*/
+void start_profile(solver_state * st, unsigned long long * before)
+{
+	if (!st->profiling)
+		open_profile(&st->profile, 0);
+	st->profiling = 1;
+	read_profile(&st->profile, before);
+}
+
+/*
+	Solves p with the engine chosen in opt, without looking at the cache (see run_engine),
+	leaving the board in st and adding its statistics to st->total. Returns the statistics
+	of this puzzle.
+*/
+solver_stats * run_solver(const solver_options * opt, solver_state * st, puzzle * p)
+{
+	solver_stats * stats;
+	unsigned long long before[PROFILE_EVENTS];
+	if (opt->profile)
+		start_profile(st, before);
+	if (opt->phase_event)
+		open_phase_counter(opt->phase_event - 1);	// once per thread
+
+	st->npuzzles++;
+	if (p->box_size * p->box_size > st->max_n)
+		st->max_n = p->box_size * p->box_size;
+	if (opt->engine == COUNTER_ENGINE)
+		{
+			new_sudoku(&st->s);
+			load_puzzle(&st->s, p);
+			st->s.stats.solutions = solve(&st->s);
+			stats = &st->s.stats;
+		}
+	else if (opt->engine == DLX_ENGINE)
+		{
+			if (!st->exact)
+				{
+					st->exact = malloc(sizeof(dlx));
+					assert(st->exact != NULL);
+					st->exact->box_size = 0;
+				}
+			stats = dlx_run(opt, st->exact, p);
+		}
+	else
+		{
+			const board_kind * kind = board_kinds[p->box_size];
+			if (!st->boards[p->box_size])
+				st->boards[p->box_size] = alloc_aligned(kind->board_bytes);
+			stats = kind->run(opt, st->boards[p->box_size], p);
+		}
+
+	if (opt->profile)
+		add_profile(&st->profile, before, stats->counters);
+	add_stats(&st->total, stats);
+	return stats;
+}
+
+/*
+	Writes the board of the last puzzle solved with st, as sprint() would.
+*/
+int sprint_result(const solver_options * opt, solver_state * st, int box_size, enum print_mode mode, char * out)
+{
+	if (st->cached)
+		return sprint_board(&st->hit, mode, out);
+	if (opt->engine == COUNTER_ENGINE)
+		return sprint(&st->s, mode, out);
+	if (opt->engine == DLX_ENGINE)
+		return sprint_board(&st->exact->board, mode, out);
+	return board_kinds[box_size]->sprint(st->boards[box_size], mode, out);
+}
+
+/*
+	run_solver through the cache of opt, if any: a puzzle found there is not searched again,
+	st->cached is set and the board to print is in st->hit; one searched is added to the
+	cache, unless the search was given up. Either way its statistics (those of the search
+	that first solved it, for a hit) are added to st->total and returned. Counting solutions
+	bypasses the cache.
+*/
+solver_stats * run_engine(const solver_options * opt, solver_state * st, puzzle * p)
+{
+	st->cached = 0;
+	if (!opt->cache || opt->output == COUNT_OUTPUT)
+		return run_solver(opt, st, p);
+
+	puzzle form, solution;
+	canon_map map;
+	canonicalize(p, &form, &map);
+	if (cache_lookup(opt->cache, &form, &solution, &st->hit_stats))
+		{
+			from_canon(&map, &solution, &st->hit);
+			st->cached = 1;
+			st->npuzzles++;
+			add_stats(&st->total, &st->hit_stats);
+			return &st->hit_stats;
+		}
+
+	solver_stats * stats = run_solver(opt, st, p);
+	if (stats->timeouts == 0)
+		{
+			char text[BOARD_TEXT_SIZE];
+			int n = p->box_size * p->box_size, k;
+			puzzle board;
+			sprint_result(opt, st, p->box_size, LINEAR_VALUE, text);
+			board.box_size = p->box_size;
+			for(k = 0; k < n*n; k++)
+				board.cell[k] = text[k] == '*' ? EMPTY_CELL : strchr(digit_symbols, text[k]) - digit_symbols - 1;
+			to_canon(&map, &board, &solution);
+			cache_insert(opt->cache, &form, &solution, stats);
+		}
+	return stats;
+}
+
+/*
+	Writes the number of solutions of a puzzle for --output=count: 0, 1, ... or "N+" when
+	the count stopped at the limit N, or timeout when it went beyond --max-nodes or --max-time.
+*/
+int sprint_count(const solver_options * opt, const solver_stats * st, char * out)
+{
+	if (st->timeouts)
+		return sprintf(out, "timeout\n");
+	if (st->solutions >= opt->count_limit)
+		return sprintf(out, "%d+\n", opt->count_limit);
+	return sprintf(out, "%lld\n", st->solutions);
+}
+
+/*
+	Difficulty rating: the number of nodes of the whole search tree of a puzzle, with singles
+	propagation, branching on the first cell (in reading order) with the fewest hypothesis.
+	The search goes through every branch, as when counting the solutions, so the order in
+	which the numbers of a cell are tried changes nothing, and neither do the engine, the
+	backtracking mode or the threads the puzzle is solved with: it is always rated by the
+	bitmask engine with the options below. Only puzzles with a single solution are rated
+	(with several, the first two found depend on that order).
+*/
+const solver_options rating_options = { BITMASK_ENGINE, SINGLES_PROPAGATION, 1, DEFAULT_SPLIT_DEPTH, COUNT_OUTPUT, UNDO_BACKTRACK, 0, 0, 2, 0, NULL,
+	FIRST_CELL, ASCENDING_VALUES, CELL_BRANCHING, 0, 0, 0, 0, 0 };
+
+// the rating of p, or 0 if it does not have a single solution
+long long rate_puzzle(solver_state * st, puzzle * p)
+{
+	solver_stats * stats = run_solver(&rating_options, st, p);
+	return stats->solutions == 1 ? stats->nodes : 0;
+}
+
+// the rating, or multiple or unsolvable
+int sprint_rating(solver_state * st, puzzle * p, char * out)
+{
+	solver_stats * stats = run_solver(&rating_options, st, p);
+	if (stats->solutions != 1)
+		return sprintf(out, "%s\n", stats->solutions ? "multiple" : "unsolvable");
+	return sprintf(out, "%lld\n", stats->nodes);
+}
+
+/*
+	With a slow lane (st->requeue), hands a search that run_engine just gave up over to it,
+	before the board is used again, instead of printing its record: the record will go to
+	out, and its statistics come back out of st, to be counted once the slow lane is done
+	with it. Returns 1 if the search was requeued.
+*/
+int requeue_timeout(solver_state * st, const solver_stats * stats, int box_size, char * out)
+{
+	if (!st->requeue || !stats->timeouts || st->cached)
+		return 0;
+	sub_stats(&st->total, stats);
+	st->npuzzles--;
+	st->requeue(st->requeue_arg, st->boards[box_size], box_size, out);
+	return 1;
+}
+
+/*
+	Solves p and writes the record selected by opt->output to out (RECORD_TEXT_SIZE chars):
+	the solution as a grid or on one line, the statistics of the search (see sprint_stats),
+	its hardware counters (see sprint_profile), the number of solutions (see sprint_count) or
+	the rating (see sprint_rating). Returns the length of the text.
+*/
+int solve_puzzle(const solver_options * opt, solver_state * st, puzzle * p, char * out)
+{
+	if (opt->output == RATING_OUTPUT)
+		return sprint_rating(st, p, out);
+
+	enum print_mode mode = opt->output == LINEAR_OUTPUT ? LINEAR_VALUE : VALUE;
+
+	solver_stats * stats = run_engine(opt, st, p);
+	if (requeue_timeout(st, stats, p->box_size, out))
+		return 0;
+	if (opt->output == STATS_OUTPUT)
+		return sprint_stats(stats, p->box_size * p->box_size, out);
+	if (opt->output == PROFILE_OUTPUT)
+		return sprint_profile(stats, out);
+	if (opt->output == COUNT_OUTPUT)
+		return sprint_count(opt, stats, out);
+	return sprint_result(opt, st, p->box_size, mode, out);
+}
+
+/*
+	SIMD engine.
+	Puzzles are taken in groups, and the 9x9 puzzles of a group are propagated together, one
+	per vector lane (see simd_lanes.inc): 16 lanes with AVX-512, 8 with AVX2, whichever the
+	CPU has, picked at run time. A puzzle that singles solve is done there; the others go on
+	in the bitmask engine, from the cells their lane filled (or from the start if their lane
+	found no solution). Without AVX2, with --propagate=none, and for the other board sizes,
+	every puzzle goes through the bitmask engine alone.
+*/
+
+enum lane_status { LANE_SOLVED, LANE_STALLED, LANE_FAILED };
+
+#define SIMD_MAX_LANES 16
+#define SIMD_SIZED(name) SIZED2(name, SIMD_NAME)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LANES 8
+#define SIMD_TARGET "avx2"
+#define SIMD_NAME avx2
+#include "simd_lanes.inc"
+#undef SIMD_NAME
+#undef SIMD_TARGET
+#undef LANES
+
+#define LANES 16
+#define SIMD_TARGET "avx512f"
+#define SIMD_NAME avx512
+#include "simd_lanes.inc"
+#undef SIMD_NAME
+#undef SIMD_TARGET
+#undef LANES
+#endif
+
+static int simd_lanes;		// lanes of propagate_lanes, 0 if the CPU has no vector unit for it
+static void (*propagate_lanes)(const puzzle * const * p, int count, puzzle * result, enum lane_status * status);
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+void select_simd(void)
+{
+	pthread_once(&peers_once_9, init_peers_9);		// the lanes use the 9x9 unit tables
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		{
+			propagate_lanes = simd_propagate_avx512;
+			simd_lanes = 16;
+		}
+	else if (__builtin_cpu_supports("avx2"))
+		{
+			propagate_lanes = simd_propagate_avx2;
+			simd_lanes = 8;
+		}
+#endif
+}
+
+/*
+	Returns how many puzzles opt solves at once: the lanes of the SIMD engine, or 1.
+*/
+int group_size(const solver_options * opt)
+{
+	pthread_once(&simd_once, select_simd);
+	if (opt->engine != SIMD_ENGINE || opt->propagation == NO_PROPAGATION || opt->output == RATING_OUTPUT || simd_lanes == 0)
+		return 1;
+	return simd_lanes;
+}
+
+int count_empty(const puzzle * p)
+{
+	int i, nempty = 0;
+	for(i = 0; i < p->box_size * p->box_size * p->box_size * p->box_size; i++)
+		nempty += p->cell[i] == EMPTY_CELL;
+	return nempty;
+}
+
+/*
+	Bounded search in the vector lanes (--lane-depth=D). The lanes are idle for the puzzles
+	singles leave open, while most of those only need a guess or two: each of them branches,
+	as bit_solve would, on the first cell with the fewest hypothesis, and all its children (one
+	per number) go through the lanes together with those of the other puzzles of the group.
+	The tree is walked in the order of bit_solve: a child with no solution is a backtrack, the
+	first one singles solve is the solution, and the first one left open branches in turn, up
+	to D levels. A puzzle whose search reaches an open board at level D, or has no solution,
+	goes to the bitmask engine as before, from where the first lanes left it.
+
+	Solutions are the ones the bitmask engine finds, and so are nodes, backtracks, max_depth
+	and the branching histogram; propagated only counts the cells filled on the way to the
+	solution, not those of the branches that failed.
+*/
+
+enum tree_state { TREE_PENDING, TREE_SOLVED, TREE_GIVEN_UP };
+
+// The children of a node of lane_search, one per hypothesis of its cell
+typedef struct {
+	puzzle child[9];
+	enum lane_status status[9];
+	int nchildren;
+	int next;		// first child not known to have failed
+} lane_frame;
+
+// The search of one puzzle of the group
+typedef struct lane_tree {
+	lane_frame frame[MAX_LANE_DEPTH];	// the path from the root
+	int depth;
+	enum tree_state state;	// pending: the children of the last frame wait for the lanes
+	const puzzle * solution;
+	solver_stats stats;
+} lane_tree;
+
+/*
+	Makes the children of b, a 9x9 board that singles left open, in a new frame of t.
+*/
+void branch_lanes(lane_tree * t, const puzzle * b)
+{
+	unsigned int used[27] = { 0 }, poss = 0;
+	int i, best = -1, min = 10;
+	for(i = 0; i < 81; i++)
+		if (b->cell[i] != EMPTY_CELL)
+			{
+				used[cell_row_9[i]] |= 1u << b->cell[i];
+				used[9 + cell_col_9[i]] |= 1u << b->cell[i];
+				used[18 + cell_box_9[i]] |= 1u << b->cell[i];
+			}
+	// the first cell with the fewest hypothesis, as bit_get_most_constrained_cell
+	for(i = 0; i < 81 && min > 1; i++)
+		if (b->cell[i] == EMPTY_CELL)
+			{
+				unsigned int c = ~(used[cell_row_9[i]] | used[9 + cell_col_9[i]] | used[18 + cell_box_9[i]]) & 0x1ff;
+				if (__builtin_popcount(c) < min)
+					{
+						min = __builtin_popcount(c);
+						best = i;
+						poss = c;
+					}
+			}
+	assert(best >= 0);
+
+	lane_frame * f = &t->frame[t->depth++];
+	STAT(t->stats.branching[min]++);
+	STAT(if (t->depth > t->stats.max_depth) t->stats.max_depth = t->depth);
+	STAT(t->stats.propagated--);	// the number guessed at this level, on the path to the solution
+	f->nchildren = f->next = 0;
+	for(; poss; poss &= poss - 1)
+		{
+			// only the 81 cells: a puzzle has room for the largest board
+			f->child[f->nchildren].box_size = 3;
+			memcpy(f->child[f->nchildren].cell, b->cell, 81);
+			f->child[f->nchildren++].cell[best] = __builtin_ctz(poss);
+		}
+	t->state = TREE_PENDING;
+}
+
+/*
+	Walks t once the children of its last frame are propagated: finds its solution, gives
+	it up, or branches again.
+*/
+void walk_lanes(lane_tree * t, int max_depth)
+{
+	for(;;)
+		{
+			lane_frame * f = &t->frame[t->depth - 1];
+			if (f->next == f->nchildren)
+				{
+					// every child failed: so did the node, and its parent tries its next number
+					STAT(t->stats.propagated++);
+					if (--t->depth == 0)
+						{
+							t->state = TREE_GIVEN_UP;
+							return;
+						}
+					t->frame[t->depth - 1].next++;
+					continue;
+				}
+			if (f->status[f->next] == LANE_FAILED)
+				{
+					t->stats.backtracks++;
+					f->next++;
+					continue;
+				}
+			if (f->status[f->next] == LANE_SOLVED)
+				{
+					t->stats.nodes++;
+					t->state = TREE_SOLVED;
+					t->solution = &f->child[f->next];
+					return;
+				}
+			if (t->depth == max_depth)
+				{
+					t->state = TREE_GIVEN_UP;
+					return;
+				}
+			t->stats.nodes++;
+			branch_lanes(t, &f->child[f->next]);
+			return;
+		}
+}
+
+/*
+	Searches the puzzles of the group that their lanes left open (status LANE_STALLED in
+	result), up to opt->lane_depth levels. Those solved get LANE_SOLVED, their solution in
+	result and the statistics of their search in stats; the others stay as they were.
+*/
+void lane_search(const solver_options * opt, solver_state * st, puzzle * result, enum lane_status * status, int nlanes,
+	solver_stats * stats)
+{
+	const puzzle * in[SIMD_MAX_LANES * 9];
+	puzzle * child[SIMD_MAX_LANES * 9];
+	enum lane_status * child_status[SIMD_MAX_LANES * 9];
+	puzzle out[SIMD_MAX_LANES];
+	enum lane_status out_status[SIMD_MAX_LANES];
+	int lane, k, j;
+
+	if (!st->trees)
+		{
+			st->trees = malloc(SIMD_MAX_LANES * sizeof(lane_tree));
+			assert(st->trees != NULL);
+		}
+	for(lane = 0; lane < nlanes; lane++)
+		{
+			lane_tree * t = &st->trees[lane];
+			t->state = TREE_GIVEN_UP;
+			if (status[lane] != LANE_STALLED)
+				continue;
+			memset(&t->stats, 0, sizeof(solver_stats));
+			t->stats.nodes = 1;
+			t->depth = 0;
+			branch_lanes(t, &result[lane]);
+		}
+
+	for(;;)
+		{
+			// the children of every pending search go through the lanes together
+			int nchildren = 0;
+			for(lane = 0; lane < nlanes; lane++)
+				if (st->trees[lane].state == TREE_PENDING)
+					{
+						lane_frame * f = &st->trees[lane].frame[st->trees[lane].depth - 1];
+						for(k = 0; k < f->nchildren; k++)
+							{
+								in[nchildren] = child[nchildren] = &f->child[k];
+								child_status[nchildren++] = &f->status[k];
+							}
+					}
+			if (nchildren == 0)
+				break;
+			for(j = 0; j < nchildren; j += simd_lanes)
+				{
+					int n = nchildren - j < simd_lanes ? nchildren - j : simd_lanes;
+					propagate_lanes(&in[j], n, out, out_status);
+					for(k = 0; k < n; k++)
+						{
+							memcpy(child[j+k]->cell, out[k].cell, 81);
+							*child_status[j+k] = out_status[k];
+						}
+				}
+			for(lane = 0; lane < nlanes; lane++)
+				if (st->trees[lane].state == TREE_PENDING)
+					walk_lanes(&st->trees[lane], opt->lane_depth);
+		}
+
+	for(lane = 0; lane < nlanes; lane++)
+		if (st->trees[lane].state == TREE_SOLVED)
+			{
+				status[lane] = LANE_SOLVED;
+				memcpy(result[lane].cell, st->trees[lane].solution->cell, 81);
+				stats[lane] = st->trees[lane].stats;
+			}
+}
+
+
+
+/*
+	Solves the count puzzles of p in order, as solve_puzzle() does for each, and writes their
+	records to out (count * RECORD_TEXT_SIZE chars), or nothing if out is NULL, and the length
+	of each record to lengths unless it is NULL. Returns the length of the text. Statistics are those of the bitmask engine: a puzzle solved in its
+	lane counts one node and the cells propagated there.
+*/
+int solve_puzzles(const solver_options * opt, solver_state * st, puzzle * p, int count, char * out, int * lengths)
+{
+	enum print_mode mode = opt->output == LINEAR_OUTPUT ? LINEAR_VALUE : VALUE;
+	int lanes = group_size(opt);
+	char * start = out, * record;
+	int i, k, e;
+
+	if (lanes == 1)
+		{
+			for(i = 0; i < count; i++)
+				if (out)
+					{
+						record = out;
+						out += solve_puzzle(opt, st, &p[i], out);
+						if (lengths)
+							lengths[i] = out - record;
+					}
+				else
+					run_engine(opt, st, &p[i]);
+			return out - start;
+		}
+
+	for(i = 0; i < count; i += lanes)
+		{
+			const puzzle * group[SIMD_MAX_LANES];
+			puzzle result[SIMD_MAX_LANES];
+			enum lane_status status[SIMD_MAX_LANES];
+			int lane_of[SIMD_MAX_LANES];	// lane of each puzzle of the group, -1 if it has none
+			int n = count - i < lanes ? count - i : lanes, nlanes = 0;
+
+			for(k = 0; k < n; k++)
+				if (p[i+k].box_size == 3)
+					{
+						lane_of[k] = nlanes;
+						group[nlanes++] = &p[i+k];
+					}
+				else
+					lane_of[k] = -1;
+			// with --profile, each puzzle of the lanes gets an equal share of their counters
+			unsigned long long before[PROFILE_EVENTS], share[PROFILE_EVENTS] = { 0 };
+			solver_stats searched[SIMD_MAX_LANES];		// of the puzzles the lanes solve
+			if (opt->profile && nlanes > 0)
+				start_profile(st, before);
+			if (nlanes > 0)
+				propagate_lanes(group, nlanes, result, status);
+			for(k = 0; k < nlanes; k++)
+				if (status[k] == LANE_SOLVED)
+					{
+						memset(&searched[k], 0, sizeof(solver_stats));
+						searched[k].nodes = 1;
+					}
+			if (opt->lane_depth && nlanes > 0)
+				lane_search(opt, st, result, status, nlanes, searched);
+			if (opt->profile && nlanes > 0)
+				{
+					add_profile(&st->profile, before, share);
+					for(e = 0; e < PROFILE_EVENTS; e++)
+						share[e] /= nlanes;
+				}
+
+			for(k = 0; k < n; k++)
+				{
+					int lane = lane_of[k];
+					if (lane >= 0 && status[lane] == LANE_FAILED)
+						for(e = 0; e < PROFILE_EVENTS; e++)
+							st->total.counters[e] += share[e];		// only in the totals: the puzzle starts over
+					record = out;
+					if (lane < 0 || status[lane] == LANE_FAILED)
+						{
+							if (out)
+								out += solve_puzzle(opt, st, &p[i+k], out);
+							else
+								run_engine(opt, st, &p[i+k]);
+							if (lengths)
+								lengths[i+k] = out - record;
+							continue;
+						}
+
+					solver_stats * stats;
+					STAT(int filled = count_empty(&p[i+k]) - count_empty(&result[lane]));
+					if (status[lane] == LANE_SOLVED)
+						{
+							stats = &searched[lane];
+							stats->solutions = 1;		// unique if every number was forced, the first one otherwise
+							STAT(stats->propagated += filled);
+							memcpy(stats->counters, share, sizeof(share));
+							add_stats(&st->total, stats);
+							st->npuzzles++;
+						}
+					else
+						{
+							stats = run_engine(opt, st, &result[lane]);
+							STAT(stats->propagated += filled);
+							STAT(st->total.propagated += filled);
+							for(e = 0; e < PROFILE_EVENTS; e++)
+								{
+									stats->counters[e] += share[e];
+									st->total.counters[e] += share[e];
+								}
+						}
+
+					if (lengths)
+						lengths[i+k] = 0;		// until the record is written below
+					if (!out || requeue_timeout(st, stats, 3, out))
+						continue;
+					if (opt->output == STATS_OUTPUT)
+						out += sprint_stats(stats, 9, out);
+					else if (opt->output == PROFILE_OUTPUT)
+						out += sprint_profile(stats, out);
+					else if (opt->output == COUNT_OUTPUT)
+						out += sprint_count(opt, stats, out);
+					else if (status[lane] == LANE_SOLVED)
+						out += sprint_board(&result[lane], mode, out);
+					else
+						out += sprint_result(opt, st, 3, mode, out);
+					if (lengths)
+						lengths[i+k] = out - record;
+				}
+		}
+	return out - start;
+}
+
+
+/*
+	Ranking of puzzles by difficulty, kept while a corpus is solved: the K puzzles with the
+	highest score (the backtracks of their search, or their rating with --output=rating), in
+	a min-heap whose root is the easiest of them, and a histogram of the scores in buckets of
+	powers of e, as analysis/make_histogram.sh made it: bucket 0 holds the scores of 0, bucket
+	b the scores x with int(log(x)) = b - 1.
+*/
+
+#define RANK_BUCKETS 64
+#define EULER 2.718281828459045
+
+typedef struct {
+	long long score;
+	long index;			// in the corpus, which breaks ties: the first one is the harder
+	puzzle p;
+} rank_entry;
+
+typedef struct {
+	int k;
+	int nheap;
+	rank_entry * heap;
+	long npuzzles;
+	long long buckets[RANK_BUCKETS];
+} ranking;
+
+void new_ranking(ranking * r, int k)
+{
+	r->k = k;
+	r->nheap = 0;
+	r->heap = malloc(k * sizeof(rank_entry));
+	assert(r->heap != NULL);
+	r->npuzzles = 0;
+	memset(r->buckets, 0, sizeof(r->buckets));
+}
+
+void free_ranking(ranking * r)
+{
+	free(r->heap);
+}
+
+static inline int easier(const rank_entry * a, const rank_entry * b)
+{
+	return a->score < b->score || (a->score == b->score && a->index > b->index);
+}
+
+void sift_down(ranking * r, int i)
+{
+	for(;;)
+		{
+			int c = 2*i + 1;
+			if (c >= r->nheap)
+				return;
+			if (c + 1 < r->nheap && easier(&r->heap[c+1], &r->heap[c]))
+				c++;
+			if (!easier(&r->heap[c], &r->heap[i]))
+				return;
+			rank_entry t = r->heap[i]; r->heap[i] = r->heap[c]; r->heap[c] = t;
+			i = c;
+		}
+}
+
+/*
+	Counts the next puzzle of the corpus, with its score.
+*/
+void rank_puzzle(ranking * r, const puzzle * p, long long score)
+{
+	int bucket = score > 0;
+	double bound;
+	for(bound = EULER; score >= bound && bucket < RANK_BUCKETS - 1; bound *= EULER)
+		bucket++;
+	r->buckets[bucket]++;
+
+	rank_entry e = { score, r->npuzzles++, *p };
+	if (r->nheap < r->k)
+		{
+			int i = r->nheap++;
+			r->heap[i] = e;
+			for(; i > 0 && easier(&r->heap[i], &r->heap[(i-1) / 2]); i = (i-1) / 2)
+				{
+					rank_entry t = r->heap[i]; r->heap[i] = r->heap[(i-1) / 2]; r->heap[(i-1) / 2] = t;
+				}
+		}
+	else if (r->k > 0 && easier(&r->heap[0], &e))
+		{
+			r->heap[0] = e;
+			sift_down(r, 0);
+		}
+}
+
+/*
+	Checkpoints of a shard (see shard_corpus), so that a run stopped on the way (a crash, a
+	node going down) resumes where it was instead of starting over. Every interval seconds,
+	after the chunk it just printed, the batch writer flushes the output to disk and saves
+	what the records written so far add up to: how far they went in the input and the
+	output, their statistics and, when ranking, the ranking itself, in a text file of one
+	item per line (the statistics as fprint_summary prints them). It is written beside the
+	old one, synced, then renamed over it, so a checkpoint is always whole: one from the
+	middle of a write cannot be found.
+*/
+
+typedef struct {
+	const char * path;		// DIR/shard-I-of-K.ckpt
+	int shard, nshards;
+	size_t input_size;		// of the whole input, to recognise it on a resume
+	int ranked;				// the shard is ranked by the batch rather than printed
+	double interval;		// seconds between two checkpoints (0: after every chunk)
+	long long saved_ns;		// when the last one was written
+	int complete;			// the whole shard is done
+	// the records written so far
+	long records;
+	size_t next_offset;		// in the input, of the first record not written yet
+	size_t output_bytes;
+	long npuzzles;
+	int max_n;
+	solver_stats total;
+} checkpoint;
+
+/*
+	Saves c, after out (unless the shard is ranked: rank then goes with it) is written to disk.
+	A checkpoint that cannot be saved stops the run, as a failed write does.
+*/
+void save_checkpoint(checkpoint * c, output_writer * out, const ranking * rank)
+{
+	char tmp[4096];
+	FILE * f;
+	int i, n;
+
+	if (!c->ranked)
+		{
+			flush_output(out);
+			off_t end = lseek(out->fd, 0, SEEK_CUR);
+			if (end < 0 || fdatasync(out->fd) < 0)
+				{
+					perror("checkpoint: output");
+					exit(1);
+				}
+			c->output_bytes = end;
+		}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", c->path);
+	if (!(f = fopen(tmp, "w")))
+		{
+			perror(tmp);
+			exit(1);
+		}
+	fprintf(f, "shard %d/%d\ninput_size %zu\nranked %d\ncomplete %d\nrecords %ld\nnext_offset %zu\noutput_bytes %zu\nmax_n %d\n",
+		c->shard, c->nshards, c->input_size, c->ranked, c->complete, c->records, c->next_offset, c->output_bytes, c->max_n);
+	fprint_summary(f, c->npuzzles, MAX_N, &c->total);
+	fprintf(f, "counters");
+	for(i = 0; i < PROFILE_EVENTS; i++)
+		fprintf(f, " %llu", c->total.counters[i]);
+	fprintf(f, "\n");
+	if (c->ranked)
+		{
+			// the heap as it is, which is still a heap when read back
+			fprintf(f, "top %d %d %ld\nhistogram", rank->k, rank->nheap, rank->npuzzles);
+			for(i = 0; i < RANK_BUCKETS; i++)
+				fprintf(f, " %lld", rank->buckets[i]);
+			fprintf(f, "\n");
+			for(i = 0; i < rank->nheap; i++)
+				{
+					const rank_entry * e = &rank->heap[i];
+					char text[BOARD_TEXT_SIZE];
+					int cells = e->p.box_size * e->p.box_size * e->p.box_size * e->p.box_size;
+					for(n = 0; n < cells; n++)
+						text[n] = digit_symbols[e->p.cell[n] + 1];
+					fprintf(f, "%lld %ld %.*s\n", e->score, e->index, cells, text);
+				}
+		}
+	if (fflush(f) != 0 || fsync(fileno(f)) < 0 || fclose(f) != 0 || rename(tmp, c->path) < 0)
+		{
+			perror(c->path);
+			exit(1);
+		}
+	c->saved_ns = monotonic_ns();
+}
+
+/*
+	Reads the checkpoint at c->path into c, and its ranking into rank (a new ranking of the
+	size it was saved with) if it is ranked. Returns 1, 0 if there is no checkpoint yet, or
+	-1 (after printing why) if it cannot be read.
+*/
+int load_checkpoint(checkpoint * c, ranking * rank)
+{
+	FILE * f = fopen(c->path, "r");
+	int i, n, ok = 1;
+	if (!f)
+		{
+			if (errno == ENOENT)
+				return 0;
+			perror(c->path);
+			return -1;
+		}
+
+	memset(&c->total, 0, sizeof(solver_stats));
+	ok = fscanf(f, " shard %d/%d input_size %zu ranked %d complete %d records %ld next_offset %zu output_bytes %zu max_n %d",
+		&c->shard, &c->nshards, &c->input_size, &c->ranked, &c->complete, &c->records, &c->next_offset, &c->output_bytes, &c->max_n) == 9
+		&& fscanf(f, " puzzles %ld solutions %lld timeouts %lld requeued %lld restarts %lld backtracks %lld nodes %lld max_depth %d"
+			" propagated %lld eliminated %lld pick_ticks %llu change_ticks %llu propagate_ticks %llu branching", &c->npuzzles,
+			&c->total.solutions, &c->total.timeouts, &c->total.requeued, &c->total.restarts, &c->total.backtracks, &c->total.nodes,
+			&c->total.max_depth, &c->total.propagated, &c->total.eliminated, &c->total.pick_ticks, &c->total.change_ticks,
+			&c->total.propagate_ticks) == 13;
+	for(n = 0; ok && n <= MAX_N; n++)
+		ok = fscanf(f, "%lld", &c->total.branching[n]) == 1;
+	ok = ok && fscanf(f, " counters") == 0;
+	for(i = 0; ok && i < PROFILE_EVENTS; i++)
+		ok = fscanf(f, "%llu", &c->total.counters[i]) == 1;
+
+	if (ok && c->ranked && rank)
+		{
+			int k, nheap;
+			long npuzzles = 0;
+			ok = fscanf(f, " top %d %d %ld histogram", &k, &nheap, &npuzzles) == 3 && k >= 0 && nheap >= 0 && nheap <= k;
+			new_ranking(rank, ok ? k : 0);
+			rank->npuzzles = npuzzles;
+			for(i = 0; ok && i < RANK_BUCKETS; i++)
+				ok = fscanf(f, "%lld", &rank->buckets[i]) == 1;
+			for(i = 0; ok && i < nheap; i++)
+				{
+					rank_entry * e = &rank->heap[i];
+					char text[BOARD_TEXT_SIZE];
+					ok = fscanf(f, "%lld %ld %640s", &e->score, &e->index, text) == 3
+						&& (e->p.box_size = box_size_of(strlen(text), LINEAR_INPUT)) != 0
+						&& parse_cells(text, strlen(text), e->p.box_size * e->p.box_size, e->p.cell) < 0;
+					rank->nheap = i + 1;
+				}
+			if (!ok)
+				free_ranking(rank);
+		}
+	fclose(f);
+	if (!ok)
+		{
+			fprintf(stderr, "%s: not a checkpoint\n", c->path);
+			return -1;
+		}
+	return 1;
+}
+
+/*
+	Multi-threaded batch mode.
+	The main thread reads the input into chunks of CHUNK_SIZE puzzles, which go round a ring
+	of slots: worker threads solve whole chunks into the chunk's text buffer, and a writer
+	thread prints the chunks back in input order. The ring bounds memory use: the reader
+	waits for the writer when it gets too far ahead.
+	When ranking, the workers keep the score of each puzzle instead of its text,
+	and the writer adds the chunks to the ranking, still in input order.
+	With a slow lane, a search given up at the budgets of the solver options (--max-nodes,
+	--max-time) does not print as a timeout: the worker copies its board, stopped where it
+	was, into a job for the slow lane threads and goes on with its chunk. They resume the
+	search with the larger budgets of the lane (a search given up there is a timeout), and
+	the writer puts their records back in place when it prints the chunk. A hard record only
+	holds up the output of its own chunk, while the workers keep taking new chunks.
+	With a checkpoint, every chunk also carries the statistics of its searches (and every job
+	those of its own), which the writer adds to the checkpoint as it prints them.
+*/
+
+#define CHUNK_SIZE 256
+
+enum slot_state { SLOT_FREE, SLOT_READY, SLOT_SOLVING, SLOT_DONE };
+
+// The slow lane of solve_batch: its threads, and the budgets of the searches it takes over
+typedef struct {
+	int nthreads;			// 0: no slow lane
+	long long max_nodes;	// nodes of the whole search, with those given up (0: no limit)
+	double max_time;		// milliseconds, from when the slow lane takes it (0: no limit)
+} slow_lane;
+
+// A search given up by a worker, going on in the slow lane
+typedef struct slow_job {
+	struct slow_job * next;		// in the queue of the slow lane
+	struct slow_job * next_in_chunk;
+	struct chunk * c;
+	int offset;				// where its record goes in the text of the chunk
+	int box_size;
+	void * board;			// copy of the worker's board
+	char text[RECORD_TEXT_SIZE];
+	int text_length;
+	solver_stats stats;		// of the whole search, once the slow lane is done with it
+} slow_job;
+
+typedef struct chunk {
+	puzzle puzzles[CHUNK_SIZE];
+	int npuzzles;
+	char * text;		// CHUNK_SIZE * RECORD_TEXT_SIZE chars
+	int text_length;
+	long long scores[CHUNK_SIZE];	// of each puzzle, when ranking
+	enum slot_state state;
+	slow_job * jobs;	// its requeued searches, in input order
+	slow_job ** last_job;
+	int pending;		// jobs the slow lane has not finished
+	// with a checkpoint
+	size_t end_offset;	// in the input, after its last record
+	solver_stats stats;	// of its searches, but for those of its jobs
+	long nsolved;
+	int max_n;
+} CACHE_ALIGNED chunk;
+
+typedef struct {
+	const solver_options * opt;
+	const solver_options * slow_opt;	// NULL without a slow lane
+	output_writer * out;
+	ranking * rank;			// NULL but in rank mode
+	checkpoint * ckpt;		// NULL for no checkpoints
+	solver_state * total;	// the workers add their totals here when they finish
+	chunk * slots;
+	int nslots;
+	long nread;			// chunks handed out by the reader so far
+	long next_solve;	// next chunk a worker will pick
+	long next_write;	// next chunk the writer will print
+	int eof;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;	// a chunk was read, or the input ended
+	pthread_cond_t done;	// a chunk was solved, or the input ended
+	pthread_cond_t free;	// a chunk was printed
+	slow_job * queue;		// of the slow lane, oldest first
+	slow_job ** queue_tail;
+	int workers_done;		// no more jobs will come
+	pthread_cond_t slow_ready;	// a job was queued, or workers_done was set
+} batch;
+
+// Where a worker is, for batch_requeue
+typedef struct {
+	batch * b;
+	chunk * c;
+} batch_position;
+
+/*
+	requeue function of the workers' solver_state: queues a copy of board for the slow lane.
+*/
+void batch_requeue(void * arg, void * board, int box_size, char * out)
+{
+	batch_position * at = arg;
+	size_t bytes = board_kinds[box_size]->board_bytes;
+	slow_job * j = malloc(sizeof(slow_job));
+	assert(j != NULL);
+	j->board = alloc_aligned(bytes);
+	memcpy(j->board, board, bytes);
+	j->box_size = box_size;
+	j->c = at->c;
+	j->offset = out - at->c->text;
+	j->next = j->next_in_chunk = NULL;
+	*at->c->last_job = j;		// only the worker solving the chunk touches its list
+	at->c->last_job = &j->next_in_chunk;
+
+	pthread_mutex_lock(&at->b->lock);
+	at->c->pending++;
+	*at->b->queue_tail = j;
+	at->b->queue_tail = &j->next;
+	pthread_cond_signal(&at->b->slow_ready);
+	pthread_mutex_unlock(&at->b->lock);
+}
+
+void * slow_worker(void * arg)
+{
+	batch * b = arg;
+	enum print_mode mode = b->opt->output == LINEAR_OUTPUT ? LINEAR_VALUE : VALUE;
+	solver_stats total;
+	long npuzzles = 0;
+	int max_n = N;
+	profile_counters profile;
+	memset(&total, 0, sizeof(solver_stats));
+	if (b->opt->profile)
+		open_profile(&profile, 0);
+	if (b->opt->phase_event)
+		open_phase_counter(b->opt->phase_event - 1);
+
+	pthread_mutex_lock(&b->lock);
+	for(;;)
+		{
+			while(!b->queue && !b->workers_done)
+				pthread_cond_wait(&b->slow_ready, &b->lock);
+			slow_job * j = b->queue;
+			if (!j)
+				break;
+			if (!(b->queue = j->next))
+				b->queue_tail = &b->queue;
+			pthread_mutex_unlock(&b->lock);
+
+			const board_kind * kind = board_kinds[j->box_size];
+			int n = j->box_size * j->box_size;
+			unsigned long long before[PROFILE_EVENTS];
+			if (b->opt->profile)
+				read_profile(&profile, before);
+			solver_stats * stats = kind->resume(b->slow_opt, j->board);
+			if (b->opt->profile)
+				add_profile(&profile, before, stats->counters);
+			stats->requeued = 1;
+			add_stats(&total, stats);
+			j->stats = *stats;
+			npuzzles++;
+			if (n > max_n)
+				max_n = n;
+			if (b->opt->output == STATS_OUTPUT)
+				j->text_length = sprint_stats(stats, n, j->text);
+			else if (b->opt->output == PROFILE_OUTPUT)
+				j->text_length = sprint_profile(stats, j->text);
+			else
+				j->text_length = kind->sprint(j->board, mode, j->text);
+			free(j->board);
+
+			pthread_mutex_lock(&b->lock);
+			j->c->pending--;
+			pthread_cond_broadcast(&b->done);
+		}
+	add_stats(&b->total->total, &total);
+	b->total->npuzzles += npuzzles;
+	if (max_n > b->total->max_n)
+		b->total->max_n = max_n;
+	pthread_mutex_unlock(&b->lock);
+	if (b->opt->profile)
+		close_profile(&profile);
+	return NULL;
+}
+
+void * batch_worker(void * arg)
+{
+	batch * b = arg;
+	solver_state * st = alloc_aligned(sizeof(solver_state));
+	batch_position at = { b, NULL };
+	assert(st != NULL);
+	new_solver_state(st);
+	if (b->slow_opt)
+		{
+			st->requeue = batch_requeue;
+			st->requeue_arg = &at;
+		}
+
+	pthread_mutex_lock(&b->lock);
+	for(;;)
+		{
+			while(b->next_solve == b->nread && !b->eof)
+				pthread_cond_wait(&b->ready, &b->lock);
+			if (b->next_solve == b->nread)	// input ended and everything was picked
+				break;
+			chunk * c = &b->slots[b->next_solve % b->nslots];
+			b->next_solve++;
+			c->state = SLOT_SOLVING;
+			c->jobs = NULL;
+			c->last_job = &c->jobs;
+			c->pending = 0;
+			at.c = c;
+			pthread_mutex_unlock(&b->lock);
+
+			solver_stats before = st->total;
+			long nbefore = st->npuzzles;
+			if (b->rank)
+				{
+					int i;
+					for(i = 0; i < c->npuzzles; i++)
+						c->scores[i] = b->opt->output == RATING_OUTPUT ? rate_puzzle(st, &c->puzzles[i])
+							: run_engine(b->opt, st, &c->puzzles[i])->backtracks;
+				}
+			else
+				c->text_length = solve_puzzles(b->opt, st, c->puzzles, c->npuzzles, c->text, NULL);
+			if (b->ckpt)
+				{
+					c->stats = st->total;
+					sub_stats(&c->stats, &before);
+					c->nsolved = st->npuzzles - nbefore;
+					c->max_n = st->max_n;
+				}
+
+			pthread_mutex_lock(&b->lock);
+			c->state = SLOT_DONE;
+			pthread_cond_broadcast(&b->done);
+		}
+	add_stats(&b->total->total, &st->total);
+	b->total->npuzzles += st->npuzzles;
+	if (st->max_n > b->total->max_n)
+		b->total->max_n = st->max_n;
+	pthread_mutex_unlock(&b->lock);
+	free_solver_state(st);
+	free(st);
+	return NULL;
+}
+
+void * batch_writer(void * arg)
+{
+	batch * b = arg;
+	checkpoint * ckpt = b->ckpt;
+
+	pthread_mutex_lock(&b->lock);
+	for(;;)
+		{
+			chunk * c = &b->slots[b->next_write % b->nslots];
+			while(!(b->next_write < b->nread && c->state == SLOT_DONE && c->pending == 0) && !(b->eof && b->next_write == b->nread))
+				pthread_cond_wait(&b->done, &b->lock);
+			if (b->next_write == b->nread)
+				break;
+			pthread_mutex_unlock(&b->lock);
+
+			if (b->rank)
+				{
+					int i;
+					for(i = 0; i < c->npuzzles; i++)
+						rank_puzzle(b->rank, &c->puzzles[i], c->scores[i]);
+				}
+			else
+				{
+					// the records of the slow lane go back between those of the workers
+					int written = 0;
+					slow_job * j, * next;
+					for(j = c->jobs; j; j = next)
+						{
+							write_output(b->out, c->text + written, j->offset - written);
+							write_output(b->out, j->text, j->text_length);
+							written = j->offset;
+							next = j->next_in_chunk;
+							if (ckpt)
+								{
+									add_stats(&ckpt->total, &j->stats);
+									ckpt->npuzzles++;
+								}
+							free(j);
+						}
+					write_output(b->out, c->text + written, c->text_length - written);
+				}
+			if (ckpt)
+				{
+					add_stats(&ckpt->total, &c->stats);
+					ckpt->npuzzles += c->nsolved;
+					if (c->max_n > ckpt->max_n)
+						ckpt->max_n = c->max_n;
+					ckpt->records += c->npuzzles;
+					ckpt->next_offset = c->end_offset;
+					if (monotonic_ns() - ckpt->saved_ns >= ckpt->interval * 1e9)
+						save_checkpoint(ckpt, b->out, b->rank);
+				}
+
+			pthread_mutex_lock(&b->lock);
+			c->state = SLOT_FREE;
+			b->next_write++;
+			pthread_cond_signal(&b->free);
+		}
+	pthread_mutex_unlock(&b->lock);
+	return NULL;
+}
+
+/*
+	Returns 0 if the input had a malformed record: everything before it is still solved and printed
+	(or ranked, if rank is not NULL). The statistics of all workers are added to total.
+	lane can be NULL for no slow lane; it is not used when ranking. With ckpt (NULL for none;
+	in must then be mapped), the records written are added to it and it is saved on the way.
+*/
+int solve_batch(const solver_options * opt, const slow_lane * lane, input_reader * in, output_writer * out, ranking * rank,
+	solver_state * total, enum input_type intype, int nthreads, checkpoint * ckpt)
+{
+	batch b;
+	solver_options fast_opt = *opt, slow_opt = *opt;
+	int nslow = lane && !rank ? lane->nthreads : 0;
+	b.opt = opt;
+	b.slow_opt = NULL;
+	if (nslow > 0)
+		{
+			fast_opt.resumable = 1;
+			slow_opt.max_nodes = lane->max_nodes;
+			slow_opt.max_time = lane->max_time;
+			b.opt = &fast_opt;
+			b.slow_opt = &slow_opt;
+		}
+	b.out = out;
+	b.rank = rank;
+	b.ckpt = ckpt;
+	b.total = total;
+	b.nslots = 2 * nthreads + 2;	// enough to keep every worker busy while the writer catches up
+	b.slots = alloc_aligned(b.nslots * sizeof(chunk));
+	assert(b.slots != NULL);
+	b.nread = b.next_solve = b.next_write = 0;
+	b.eof = 0;
+	pthread_mutex_init(&b.lock, NULL);
+	pthread_cond_init(&b.ready, NULL);
+	pthread_cond_init(&b.done, NULL);
+	pthread_cond_init(&b.free, NULL);
+	b.queue = NULL;
+	b.queue_tail = &b.queue;
+	b.workers_done = 0;
+	pthread_cond_init(&b.slow_ready, NULL);
+
+	int i;
+	for(i = 0; i < b.nslots; i++)
+		{
+			b.slots[i].text = malloc(CHUNK_SIZE * RECORD_TEXT_SIZE);
+			assert(b.slots[i].text != NULL);
+			b.slots[i].state = SLOT_FREE;
+		}
+
+	pthread_t * workers = malloc((nthreads + nslow) * sizeof(pthread_t));
+	pthread_t writer;
+	assert(workers != NULL);
+	for(i = 0; i < nthreads; i++)
+		pthread_create(&workers[i], NULL, batch_worker, &b);
+	for(i = 0; i < nslow; i++)
+		pthread_create(&workers[nthreads + i], NULL, slow_worker, &b);
+	pthread_create(&writer, NULL, batch_writer, &b);
+
+	int more = 1, status = 1;
+	while(more > 0)
+		{
+			chunk * c = &b.slots[b.nread % b.nslots];
+			pthread_mutex_lock(&b.lock);
+			while(c->state != SLOT_FREE)
+				pthread_cond_wait(&b.free, &b.lock);
+			pthread_mutex_unlock(&b.lock);
+
+			c->npuzzles = 0;
+			c->end_offset = in->pos;
+			while(c->npuzzles < CHUNK_SIZE && (more = read_input(in, &c->puzzles[c->npuzzles], intype)) > 0)
+				{
+					c->npuzzles++;
+					c->end_offset = in->pos;	// a malformed record stays after the end, to be found again
+				}
+
+			pthread_mutex_lock(&b.lock);
+			if (c->npuzzles > 0)
+				{
+					c->state = SLOT_READY;
+					b.nread++;
+					pthread_cond_signal(&b.ready);
+				}
+			if (more <= 0)
+				{
+					status = more == 0;
+					b.eof = 1;
+					pthread_cond_broadcast(&b.ready);
+					pthread_cond_broadcast(&b.done);
+				}
+			pthread_mutex_unlock(&b.lock);
+		}
+
+	for(i = 0; i < nthreads; i++)
+		pthread_join(workers[i], NULL);
+	pthread_mutex_lock(&b.lock);
+	b.workers_done = 1;
+	pthread_cond_broadcast(&b.slow_ready);
+	pthread_mutex_unlock(&b.lock);
+	for(i = 0; i < nslow; i++)
+		pthread_join(workers[nthreads + i], NULL);
+	pthread_join(writer, NULL);
+
+	for(i = 0; i < b.nslots; i++)
+		free(b.slots[i].text);
+	free(b.slots);
+	free(workers);
+	pthread_mutex_destroy(&b.lock);
+	pthread_cond_destroy(&b.ready);
+	pthread_cond_destroy(&b.done);
+	pthread_cond_destroy(&b.free);
+	pthread_cond_destroy(&b.slow_ready);
+	return status;
+}
+
+/*
+	Writes the n puzzles of order (linear, hardest first) to dir/top<k>.txt and the histogram
+	of buckets to dir/histogram.txt, in the formats of analysis/top10.txt and
+	analysis/histogram.txt. The puzzles and their scores also go to out. Returns 0 (after
+	printing why) if a file cannot be written.
+*/
+int write_ranking(const char * dir, int k, const rank_entry * order, int n, const long long * buckets, output_writer * out)
+{
+	char path[4096];
+	FILE * f;
+	int i, ok;
+
+	snprintf(path, sizeof(path), "%s/top%d.txt", dir, k);
+	ok = (f = fopen(path, "w")) != NULL;
+	if (ok)
+		{
+			for(i = 0; i < n; i++)
+				{
+					char text[BOARD_TEXT_SIZE], line[BOARD_TEXT_SIZE + 32];
+					int j, cells = order[i].p.box_size * order[i].p.box_size;
+					for(j = 0; j < cells * cells; j++)
+						text[j] = digit_symbols[order[i].p.cell[j] + 1];
+					fprintf(f, "%.*s\n", cells * cells, text);
+					write_output(out, line, sprintf(line, "%lld %.*s\n", order[i].score, cells * cells, text));
+				}
+			ok = fclose(f) == 0;
+		}
+
+	if (ok)
+		{
+			snprintf(path, sizeof(path), "%s/histogram.txt", dir);
+			ok = (f = fopen(path, "w")) != NULL;
+		}
+	if (ok)
+		{
+			double bound = 1;		// e^(i-1), the lowest count of bucket i
+			for(i = 0; i < RANK_BUCKETS; i++)
+				{
+					if (buckets[i] > 0)
+						fprintf(f, "%4lld %g\n", buckets[i], i == 0 ? 0.0 : bound);
+					if (i > 0)
+						bound *= EULER;
+				}
+			ok = fclose(f) == 0;
+		}
+	if (!ok)
+		perror(path);
+	return ok;
+}
+
+/*
+	Takes the puzzles out of the heap of r into order, hardest first (popping the min-heap
+	gives them easiest first). Returns how many there were.
+*/
+int pop_ranking(ranking * r, rank_entry * order)
+{
+	int i, n = r->nheap;
+	for(i = n - 1; i >= 0; i--)
+		{
+			order[i] = r->heap[0];
+			r->heap[0] = r->heap[--r->nheap];
+			sift_down(r, 0);
+		}
+	return n;
+}
+
+/*
+	Rank mode: solves the whole input with nthreads workers, then writes the top k puzzles
+	and the histogram (see write_ranking). Returns 0 on a malformed record (nothing is
+	written then) or a file that cannot be written.
+*/
+int rank_corpus(const solver_options * opt, input_reader * in, output_writer * out, solver_state * total, enum input_type intype,
+	int nthreads, const char * dir, int k)
+{
+	ranking r;
+	int ok;
+
+	new_ranking(&r, k);
+	ok = solve_batch(opt, NULL, in, out, &r, total, intype, nthreads, NULL);
+
+	rank_entry * order = malloc(k * sizeof(rank_entry));
+	assert(order != NULL);
+	int n = pop_ranking(&r, order);
+	if (ok)
+		ok = write_ranking(dir, k, order, n, r.buckets, out);
+
+	free(order);
+	free_ranking(&r);
+	return ok;
+}
+
+/*
+	Sharded mode, for a corpus solved by several machines at once: each one runs
+	--shard=I/K on the same file and solves the I-th of K parts of it, in batch mode. A
+	linear file is cut by bytes, at the line starting at or after I-1 Kths of its size (a
+	record belongs to the shard of its first byte); a packed one by records, after the
+	header. With a checkpoint directory, a shard writes its records to DIR/shard-I-of-K.txt
+	and checkpoints to DIR/shard-I-of-K.ckpt (when ranking, DIR is the one of --rank and the
+	ranking goes to the checkpoint). Started again after a crash, it cuts the records past
+	the last checkpoint off its output and goes on from there; a shard already complete
+	does nothing. --merge=DIR then puts the shards back together, once they are all
+	complete: their records in order on the output, or the top puzzles and histogram of
+	the whole corpus, as --rank writes them, and the statistics of all of them for --summary.
+*/
+
+#define SHARD_NAME_SIZE 4096
+
+// the start of the line holding byte at
+size_t line_start(const input_reader * in, size_t at)
+{
+	if (at == 0)
+		return 0;
+	const char * end = memchr(in->data + at - 1, '\n', in->mapped_size - (at - 1));
+	return end ? (size_t) (end - in->data + 1) : in->mapped_size;
+}
+
+/*
+	Moves in, a mapped file, to the record at pos, counting the lines (or the packed records)
+	before it for the error messages.
+*/
+void seek_input(input_reader * in, size_t pos)
+{
+	const char * at, * end = in->data + pos;
+	if (in->packed_box_size)
+		in->line = 1 + (pos - PACKED_HEADER_SIZE) / PACKED_RECORD_SIZE(in->packed_box_size * in->packed_box_size);
+	else
+		for(in->line = 1, at = in->data; (at = memchr(at, '\n', end - at)); at++)
+			in->line++;
+	in->pos = pos;
+}
+
+/*
+	Restricts in, a mapped file, to the records of shard (from 1) of nshards. Returns 0
+	(after printing why) if it cannot be split.
+*/
+int shard_input(input_reader * in, enum input_type intype, int shard, int nshards)
+{
+	size_t size = in->mapped_size;
+	if (!in->mapped)
+		{
+			fprintf(stderr, "%s: --shard needs a regular file, not empty\n", in->name);
+			return 0;
+		}
+	if (intype == PACKED_INPUT)
+		{
+			int b = 0;
+			if (size >= PACKED_HEADER_SIZE && memcmp(in->data, PACKED_MAGIC, PACKED_HEADER_SIZE - 1) == 0)
+				b = in->data[PACKED_HEADER_SIZE - 1];
+			if (b < 2 || b > MAX_SQRT_N)
+				{
+					fprintf(stderr, "%s: not a packed puzzle file\n", in->name);
+					return 0;
+				}
+			if (in->only_box_size && b != in->only_box_size)
+				{
+					fprintf(stderr, "%s: %dx%d boards need the bitmask engine\n", in->name, b*b, b*b);
+					return 0;
+				}
+			size_t record = PACKED_RECORD_SIZE(b*b), nrecords = (size - PACKED_HEADER_SIZE) / record;
+			in->packed_box_size = b;
+			seek_input(in, PACKED_HEADER_SIZE + (shard - 1) * nrecords / nshards * record);
+			// the last shard keeps a truncated record, for read_packed to report
+			in->size = shard == nshards ? size : PACKED_HEADER_SIZE + shard * nrecords / nshards * record;
+		}
+	else
+		{
+			seek_input(in, line_start(in, (shard - 1) * size / nshards));
+			in->size = line_start(in, shard * size / nshards);
+		}
+	return 1;
+}
+
+// names the files of shard in dir, with suffix ("txt" or "ckpt")
+void shard_path(char * path, const char * dir, int shard, int nshards, const char * suffix)
+{
+	snprintf(path, SHARD_NAME_SIZE, "%s/shard-%d-of-%d.%s", dir, shard, nshards, suffix);
+}
+
+/*
+	Solves shard of nshards of in with nthreads workers, like solve_batch (or, with ranked,
+	ranks it into the top k). With dir, the records go to their file there and the shard is
+	checkpointed there every interval seconds, and resumed from its checkpoint; out is then
+	not used. Returns 0 on a malformed record, or an input or checkpoint that cannot be used.
+*/
+int shard_corpus(const solver_options * opt, const slow_lane * lane, input_reader * in, output_writer * out, solver_state * total,
+	enum input_type intype, int nthreads, int shard, int nshards, const char * dir, int ranked, int k, double interval)
+{
+	char path[SHARD_NAME_SIZE], text_path[SHARD_NAME_SIZE];
+	checkpoint c;
+	ranking r;
+	output_writer file;
+	int fd = -1, status, loaded = 0;
+
+	if (!shard_input(in, intype, shard, nshards))
+		return 0;
+	memset(&c, 0, sizeof(c));
+	if (dir)
+		{
+			shard_path(path, dir, shard, nshards, "ckpt");
+			c.path = path;
+			if ((loaded = load_checkpoint(&c, ranked ? &r : NULL)) < 0)
+				return 0;
+			if (loaded && (c.shard != shard || c.nshards != nshards || c.input_size != in->mapped_size || c.ranked != ranked
+				|| (ranked && r.k != k) || c.next_offset < in->pos || c.next_offset > in->size))
+				{
+					fprintf(stderr, "%s: checkpoint of another run\n", path);
+					if (ranked && c.ranked)
+						free_ranking(&r);
+					return 0;
+				}
+		}
+	if (!loaded)
+		{
+			c.shard = shard;
+			c.nshards = nshards;
+			c.input_size = in->mapped_size;
+			c.ranked = ranked;
+			c.next_offset = in->pos;
+			c.max_n = N;
+			if (ranked)
+				new_ranking(&r, k);
+		}
+	c.interval = interval;
+	c.saved_ns = monotonic_ns();
+	add_stats(&total->total, &c.total);
+	total->npuzzles += c.npuzzles;
+	if (c.max_n > total->max_n)
+		total->max_n = c.max_n;
+	if (c.complete)
+		{
+			fprintf(stderr, "%s: shard %d of %d already complete\n", path, shard, nshards);
+			if (ranked)
+				free_ranking(&r);
+			return 1;
+		}
+	seek_input(in, c.next_offset);
+
+	if (dir && !ranked)
+		{
+			// what was written after the checkpoint comes again
+			shard_path(text_path, dir, shard, nshards, "txt");
+			if ((fd = open(text_path, O_WRONLY | O_CREAT, 0644)) < 0 || ftruncate(fd, c.output_bytes) < 0
+				|| lseek(fd, 0, SEEK_END) < 0)
+				{
+					perror(text_path);
+					if (fd >= 0)
+						close(fd);
+					return 0;
+				}
+			open_output(&file, fd);
+			out = &file;
+		}
+
+	status = solve_batch(opt, ranked ? NULL : lane, in, out, ranked ? &r : NULL, total, intype, nthreads, dir ? &c : NULL);
+	if (dir)
+		{
+			// after a malformed record, what came before it is kept
+			c.complete = status;
+			save_checkpoint(&c, out, ranked ? &r : NULL);
+		}
+	if (fd >= 0)
+		{
+			close_output(&file);
+			close(fd);
+		}
+	if (ranked)
+		free_ranking(&r);
+	return status;
+}
+
+int harder_first(const void * a, const void * b)
+{
+	return easier(b, a) ? -1 : easier(a, b);
+}
+
+/*
+	Puts together the complete shards in dir (see above): writes their records to out in
+	order, or the ranking of the whole corpus, and adds their statistics to total. Returns 0
+	(after printing why) if a shard is missing or not complete.
+*/
+int merge_shards(const char * dir, output_writer * out, solver_state * total)
+{
+	char path[SHARD_NAME_SIZE];
+	int nshards = 0, shard, count, length, ok = 1, ranked = 0, k = 0, n = 0;
+	rank_entry * order = NULL;
+	long long buckets[RANK_BUCKETS];
+	struct dirent * entry;
+	DIR * d = opendir(dir);
+	if (!d)
+		{
+			perror(dir);
+			return 0;
+		}
+	while(ok && (entry = readdir(d)))
+		if (sscanf(entry->d_name, "shard-%d-of-%d.ckpt%n", &shard, &count, &length) == 2
+			&& length == (int) strlen(entry->d_name))
+			{
+				if (nshards && count != nshards)
+					{
+						fprintf(stderr, "%s: shards of a split in %d and of one in %d\n", dir, nshards, count);
+						ok = 0;
+					}
+				nshards = count;
+			}
+	closedir(d);
+	if (ok && nshards == 0)
+		{
+			fprintf(stderr, "%s: no shard\n", dir);
+			ok = 0;
+		}
+
+	memset(buckets, 0, sizeof(buckets));
+	for(shard = 1; ok && shard <= nshards; shard++)
+		{
+			checkpoint c;
+			ranking r;
+			int i;
+			shard_path(path, dir, shard, nshards, "ckpt");
+			c.path = path;
+			if ((ok = load_checkpoint(&c, &r)) <= 0)
+				{
+					if (ok == 0)
+						fprintf(stderr, "%s: shard %d of %d missing\n", path, shard, nshards);
+					ok = 0;
+					break;
+				}
+			if (shard == 1)
+				{
+					ranked = c.ranked;
+					k = ranked ? r.k : 0;
+					order = malloc((nshards * k + 1) * sizeof(rank_entry));
+					assert(order != NULL);
+				}
+			if (!c.complete || c.ranked != ranked || (ranked && r.k != k))
+				{
+					fprintf(stderr, "%s: shard %d of %d %s\n", path, shard, nshards, c.complete ? "of another run" : "not complete");
+					ok = 0;
+				}
+
+			if (ok && ranked)
+				{
+					// the first shards hold the first puzzles, which win ties
+					for(i = 0; i < r.nheap; i++)
+						{
+							order[n] = r.heap[i];
+							order[n++].index += (long) shard << 40;
+						}
+					for(i = 0; i < RANK_BUCKETS; i++)
+						buckets[i] += r.buckets[i];
+				}
+			else if (ok)
+				{
+					char * block = malloc(OUTPUT_BLOCK_SIZE);
+					size_t left = c.output_bytes;
+					int fd;
+					assert(block != NULL);
+					shard_path(path, dir, shard, nshards, "txt");
+					if ((fd = open(path, O_RDONLY)) < 0)
+						ok = 0;
+					while(ok && left > 0)
+						{
+							ssize_t got = read(fd, block, left < OUTPUT_BLOCK_SIZE ? left : OUTPUT_BLOCK_SIZE);
+							if (got <= 0)
+								{
+									if (got < 0 && errno == EINTR)
+										continue;
+									if (got == 0)
+										errno = EIO;	// shorter than its checkpoint
+									ok = 0;
+									break;
+								}
+							write_output(out, block, got);
+							left -= got;
+						}
+					if (!ok)
+						perror(path);
+					if (fd >= 0)
+						close(fd);
+					free(block);
+				}
+			if (ranked)
+				free_ranking(&r);
+
+			add_stats(&total->total, &c.total);
+			total->npuzzles += c.npuzzles;
+			if (c.max_n > total->max_n)
+				total->max_n = c.max_n;
+		}
+
+	if (ok && ranked)
+		{
+			// hardest first: sorting the tops of all shards gives their top
+			qsort(order, n, sizeof(rank_entry), harder_first);
+			ok = write_ranking(dir, k, order, n < k ? n : k, buckets, out);
+		}
+	free(order);
+	return ok;
+}
+
+/*
+	Streaming mode, for input that never ends (a feed from another process on stdin).
+	Records go one at a time through three stages: the main thread parses them, nthreads
+	workers solve them, and an emitter thread writes them out. They live in a pool of
+	STREAM_RECORDS records, whose indices go round three rings: free records to the parser,
+	parsed records to the workers, solved records to the emitter, which puts them back in
+	the free ring once written. The pool bounds memory and gives backpressure: when every
+	record is in flight, the parser waits for the emitter, and reads no further ahead.
+	The emitter writes records in input order (holding back those solved ahead of an older
+	one), or with unordered, as soon as they are solved, each after its record number (from 1)
+	so that the reader can match them. What it has written goes out whenever it runs out of
+	solved records, so nothing waits for a full output block.
+*/
+
+#define STREAM_RECORDS 1024
+#define RING_SIZE (2 * STREAM_RECORDS)		// records, and the stop marks of the workers
+#define RING_SPINS 1000		// tries of a waiting pop before it sleeps
+#define STOP_RECORD -1
+
+/*
+	Bounded lock-free queue of ints for several producers and consumers (Vyukov's): every
+	cell has a sequence number that says whether it is free for the push of round pos or
+	holds the value for the pop of round pos. head and tail only move by compare and swap.
+	The rings of the streaming mode never fill up (they are larger than the pool), so only
+	a pop can wait: it spins a while, then sleeps until a push sees it asleep and wakes it.
+*/
+typedef struct {
+	unsigned long seq;
+	int value;
+} ring_cell;
+
+typedef struct {
+	ring_cell cells[RING_SIZE];
+	unsigned long head __attribute__ ((aligned (64)));	// next push
+	unsigned long tail __attribute__ ((aligned (64)));	// next pop
+	int sleepers __attribute__ ((aligned (64)));		// pops waiting on nonempty
+	pthread_mutex_t lock;
+	pthread_cond_t nonempty;
+} ring;
+
+void new_ring(ring * r)
+{
+	int i;
+	for(i = 0; i < RING_SIZE; i++)
+		r->cells[i].seq = i;
+	r->head = r->tail = 0;
+	r->sleepers = 0;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->nonempty, NULL);
+}
+
+void free_ring(ring * r)
+{
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->nonempty);
+}
+
+void ring_push(ring * r, int value)
+{
+	unsigned long pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	ring_cell * c;
+	for(;;)
+		{
+			c = &r->cells[pos % RING_SIZE];
+			long diff = (long) (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - pos);
+			assert(diff >= 0);		// full: cannot happen, see RING_SIZE
+			if (diff == 0 && __atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+			if (diff > 0)
+				pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+		}
+	c->value = value;
+	__atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+
+	// either a sleeper sees the value, or this sees the sleeper (both sides are seq_cst)
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->sleepers, __ATOMIC_SEQ_CST))
+		{
+			pthread_mutex_lock(&r->lock);
+			pthread_cond_broadcast(&r->nonempty);
+			pthread_mutex_unlock(&r->lock);
+		}
+}
+
+// returns 0 if the ring is empty
+int ring_try_pop(ring * r, int * value)
+{
+	unsigned long pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	ring_cell * c;
+	for(;;)
+		{
+			c = &r->cells[pos % RING_SIZE];
+			long diff = (long) (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+			if (diff < 0)
+				return 0;
+			if (diff == 0 && __atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+			if (diff > 0)
+				pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+		}
+	*value = c->value;
+	__atomic_store_n(&c->seq, pos + RING_SIZE, __ATOMIC_RELEASE);
+	return 1;
+}
+
+int ring_pop(ring * r)
+{
+	int value, i;
+	for(i = 0; i < RING_SPINS; i++)
+		if (ring_try_pop(r, &value))
+			return value;
+	pthread_mutex_lock(&r->lock);
+	__atomic_add_fetch(&r->sleepers, 1, __ATOMIC_SEQ_CST);
+	while(!ring_try_pop(r, &value))
+		pthread_cond_wait(&r->nonempty, &r->lock);
+	__atomic_sub_fetch(&r->sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&r->lock);
+	return value;
+}
+
+typedef struct {
+	long id;			// record number, from 1
+	puzzle p;
+	char text[RECORD_TEXT_SIZE + 32];	// and its record number, when unordered
+	int text_length;
+} CACHE_ALIGNED stream_record;
+
+typedef struct {
+	const solver_options * opt;
+	output_writer * out;
+	int nthreads;
+	int unordered;
+	stream_record * records;	// the pool
+	ring free, parsed, solved;
+} stream;
+
+typedef struct {
+	stream * s;
+	solver_state * st;
+} stream_worker_arg;
+
+/*
+	Solves parsed records until it pops a stop mark. With the SIMD engine, the records already
+	parsed when it pops one (up to the lanes) are solved with it as one group, whose records
+	are then copied out to theirs; it never waits to fill the lanes.
+*/
+void * stream_worker(void * arg)
+{
+	stream_worker_arg * w = arg;
+	stream * s = w->s;
+	int group = group_size(s->opt), stopped = 0, lengths[SIMD_MAX_LANES], batch[SIMD_MAX_LANES], i, n, k;
+	puzzle * puzzles = malloc(group * sizeof(puzzle));
+	char * texts = malloc(group * RECORD_TEXT_SIZE);
+	assert(puzzles != NULL && texts != NULL);
+	while(!stopped && (i = ring_pop(&s->parsed)) != STOP_RECORD)
+		{
+			for(batch[0] = i, n = 1; n < group && ring_try_pop(&s->parsed, &i); n++)
+				if (i == STOP_RECORD)
+					{
+						stopped = 1;
+						break;
+					}
+				else
+					batch[n] = i;
+			for(k = 0; k < n; k++)
+				memcpy(&puzzles[k], &s->records[batch[k]].p, sizeof(puzzle));
+			solve_puzzles(s->opt, w->st, puzzles, n, texts, lengths);
+
+			char * from = texts;
+			for(k = 0; k < n; k++)
+				{
+					stream_record * r = &s->records[batch[k]];
+					char * text = r->text;
+					if (s->unordered)
+						text += sprintf(text, s->opt->output == GRID_OUTPUT ? "%ld\n" : "%ld ", r->id);
+					memcpy(text, from, lengths[k]);
+					from += lengths[k];
+					r->text_length = text + lengths[k] - r->text;
+					ring_push(&s->solved, batch[k]);
+				}
+		}
+	ring_push(&s->solved, STOP_RECORD);
+	free(puzzles);
+	free(texts);
+	return NULL;
+}
+
+void * stream_emitter(void * arg)
+{
+	stream * s = arg;
+	int * held = malloc(STREAM_RECORDS * sizeof(int));	// solved records by id, until their turn
+	long next = 1;		// id of the next record, in order
+	int nstopped = 0, i, k;
+	assert(held != NULL);
+	for(k = 0; k < STREAM_RECORDS; k++)
+		held[k] = -1;
+
+	while(nstopped < s->nthreads)
+		{
+			if (!ring_try_pop(&s->solved, &i))
+				{
+					flush_output(s->out);	// about to wait: what is ready goes out first
+					i = ring_pop(&s->solved);
+				}
+			if (i == STOP_RECORD)
+				{
+					nstopped++;
+					continue;
+				}
+			if (s->unordered)
+				{
+					write_output(s->out, s->records[i].text, s->records[i].text_length);
+					ring_push(&s->free, i);
+					continue;
+				}
+			// ids in flight are less than STREAM_RECORDS apart
+			held[s->records[i].id % STREAM_RECORDS] = i;
+			while((i = held[next % STREAM_RECORDS]) >= 0)
+				{
+					write_output(s->out, s->records[i].text, s->records[i].text_length);
+					held[next % STREAM_RECORDS] = -1;
+					next++;
+					ring_push(&s->free, i);
+				}
+		}
+	free(held);
+	return NULL;
+}
+
+/*
+	Reads, solves and writes out records until the input ends, as described above, with
+	nthreads workers; their statistics are added to total. Returns 0 if the input had a
+	malformed record: everything before it is still solved and written.
+*/
+int stream_records(const solver_options * opt, input_reader * in, output_writer * out, solver_state * total,
+	enum input_type intype, int nthreads, int unordered)
+{
+	stream * s = malloc(sizeof(stream));
+	pthread_t * workers = malloc(nthreads * sizeof(pthread_t));
+	stream_worker_arg * args = malloc(nthreads * sizeof(stream_worker_arg));
+	pthread_t emitter;
+	int i, status;
+	long id = 0;
+	assert(s != NULL && workers != NULL && args != NULL && nthreads <= STREAM_RECORDS);
+	s->opt = opt;
+	s->out = out;
+	s->nthreads = nthreads;
+	s->unordered = unordered;
+	s->records = alloc_aligned(STREAM_RECORDS * sizeof(stream_record));
+	assert(s->records != NULL);
+	new_ring(&s->free);
+	new_ring(&s->parsed);
+	new_ring(&s->solved);
+	for(i = 0; i < STREAM_RECORDS; i++)
+		ring_push(&s->free, i);
+
+	for(i = 0; i < nthreads; i++)
+		{
+			args[i].s = s;
+			args[i].st = alloc_aligned(sizeof(solver_state));
+			assert(args[i].st != NULL);
+			new_solver_state(args[i].st);
+			pthread_create(&workers[i], NULL, stream_worker, &args[i]);
+		}
+	pthread_create(&emitter, NULL, stream_emitter, s);
+
+	for(;;)
+		{
+			i = ring_pop(&s->free);
+			if ((status = read_input(in, &s->records[i].p, intype)) <= 0)
+				break;
+			s->records[i].id = ++id;
+			ring_push(&s->parsed, i);
+		}
+	for(i = 0; i < nthreads; i++)
+		ring_push(&s->parsed, STOP_RECORD);
+
+	for(i = 0; i < nthreads; i++)
+		{
+			pthread_join(workers[i], NULL);
+			add_stats(&total->total, &args[i].st->total);
+			total->npuzzles += args[i].st->npuzzles;
+			if (args[i].st->max_n > total->max_n)
+				total->max_n = args[i].st->max_n;
+			free_solver_state(args[i].st);
+			free(args[i].st);
+		}
+	pthread_join(emitter, NULL);
+
+	free_ring(&s->free);
+	free_ring(&s->parsed);
+	free_ring(&s->solved);
+	free(s->records);
+	free(s);
+	free(workers);
+	free(args);
+	return status == 0;
+}
+
+/*
+	Generator.
+	A puzzle starts as a full grid: a few numbers put at random (where they fit), then
+	solved by the dancing links engine. Its clues are then removed one by one in random order,
+	each one kept only if the puzzle loses its single solution without it (the bitmask engine
+	counting up to 2 solutions, as the rating does), which leaves a minimal puzzle: every
+	clue is needed. Puzzles outside the bands of clues and rating asked for are thrown away
+	and started again, up to GEN_MAX_ATTEMPTS times per puzzle: a band that minimal puzzles
+	hardly ever reach (17 to 19 clues, 30 and more) stops the run with an error instead of
+	running forever.
+	Puzzle i is made from its own random sequence (drawn from the seed and i), so the output
+	is the same whatever the number of threads. Workers make chunks of GEN_CHUNK_SIZE puzzles
+	into a ring of slots, which the main thread prints in order.
+*/
+
+#define GEN_CHUNK_SIZE 16
+#define GEN_SEED_CLUES 11		// numbers put at random before solving for a full grid
+#define GEN_MAX_ATTEMPTS 10000	// puzzles started for one within the bands, before giving up
+#define GEN_MIN_CLUES 17		// no 9x9 puzzle with fewer has a single solution
+
+typedef struct {
+	long count;				// puzzles to make
+	unsigned long long seed;
+	int min_clues, max_clues;
+	long long min_rating, max_rating;	// 0 for no bound
+} gen_options;
+
+typedef struct {
+	char text[GEN_CHUNK_SIZE * (N*N + 1)];
+	int text_length;
+	long index;				// of the chunk in the slot
+	long failed;			// puzzle of the run given up at GEN_MAX_ATTEMPTS, -1 if none
+	enum slot_state state;
+} CACHE_ALIGNED gen_chunk;
+
+typedef struct {
+	const gen_options * opt;
+	gen_chunk * slots;
+	int nslots;
+	long nchunks, next;		// chunks to make (cut to those taken once a puzzle fails), next one a worker will take
+	long long attempts;		// puzzles started, including the ones thrown away
+	pthread_mutex_t lock;
+	pthread_cond_t done;	// a chunk was made
+	pthread_cond_t free;	// a chunk was printed
+} generator;
+
+// the next random number of the sequence in state
+static inline unsigned long long next_random(unsigned long long * state)
+{
+	return mix(*state += 0x9e3779b97f4a7c15ull);
+}
+
+/*
+	Makes a minimal puzzle into p with a single solution, from the random sequence in state.
+	Returns its rating.
+*/
+long long make_minimal(solver_state * st, unsigned long long * state, puzzle * p)
+{
+	int order[N*N];
+	int i, k;
+	for(;;)
+		{
+			p->box_size = SQRT_N;
+			memset(p->cell, EMPTY_CELL, N*N);
+			for(k = 0; k < GEN_SEED_CLUES; k++)
+				{
+					int cell = next_random(state) % (N*N);
+					p->cell[cell] = next_random(state) % N;
+					if (!is_consistent(p))
+						p->cell[cell] = EMPTY_CELL;
+				}
+			solver_options full = default_options;
+			full.engine = DLX_ENGINE;
+			if (run_solver(&full, st, p)->solutions == 1)
+				break;
+		}
+	*p = st->exact->board;
+
+	for(i = 0; i < N*N; i++)
+		{
+			k = next_random(state) % (i + 1);		// shuffles the cells
+			order[i] = order[k];
+			order[k] = i;
+		}
+	for(i = 0; i < N*N; i++)
+		{
+			int cell = order[i], number = p->cell[cell];
+			p->cell[cell] = EMPTY_CELL;
+			if (run_solver(&rating_options, st, p)->solutions != 1)
+				p->cell[cell] = number;
+		}
+	return rate_puzzle(st, p);
+}
+
+/*
+	Makes puzzle index of the run into out, as a linear record. Returns how many puzzles it
+	started to get one within the bands, or minus GEN_MAX_ATTEMPTS if it gave up (out is
+	then left as it was).
+*/
+int make_puzzle(const gen_options * opt, solver_state * st, long index, char * out)
+{
+	unsigned long long state = mix(opt->seed) ^ mix(index + 1);
+	int attempts = 0, clues, k;
+	long long rating;
+	puzzle p;
+	do
+		{
+			if (attempts == GEN_MAX_ATTEMPTS)
+				return -attempts;
+			attempts++;
+			rating = make_minimal(st, &state, &p);
+			for(clues = 0, k = 0; k < N*N; k++)
+				clues += p.cell[k] != EMPTY_CELL;
+		}
+	while(clues < opt->min_clues || clues > opt->max_clues
+		|| (opt->min_rating && rating < opt->min_rating) || (opt->max_rating && rating > opt->max_rating));
+	for(k = 0; k < N*N; k++)
+		out[k] = digit_symbols[p.cell[k] + 1];
+	out[N*N] = '\n';
+	return attempts;
+}
+
+void * gen_worker(void * arg)
+{
+	generator * g = arg;
+	solver_state * st = alloc_aligned(sizeof(solver_state));
+	assert(st != NULL);
+	new_solver_state(st);
+
+	pthread_mutex_lock(&g->lock);
+	while(g->next < g->nchunks)
+		{
+			long index = g->next++;
+			gen_chunk * c = &g->slots[index % g->nslots];
+			while(c->state != SLOT_FREE)
+				pthread_cond_wait(&g->free, &g->lock);
+			c->state = SLOT_SOLVING;
+			pthread_mutex_unlock(&g->lock);
+
+			long first = index * GEN_CHUNK_SIZE, i;
+			long long attempts = 0;
+			c->text_length = 0;
+			c->failed = -1;
+			for(i = first; i < first + GEN_CHUNK_SIZE && i < g->opt->count; i++)
+				{
+					int n = make_puzzle(g->opt, st, i, c->text + c->text_length);
+					attempts += n < 0 ? -n : n;
+					if (n < 0)
+						{
+							c->failed = i;
+							break;
+						}
+					c->text_length += N*N + 1;
+				}
+
+			pthread_mutex_lock(&g->lock);
+			c->index = index;
+			c->state = SLOT_DONE;
+			g->attempts += attempts;
+			pthread_cond_broadcast(&g->done);
+		}
+	pthread_mutex_unlock(&g->lock);
+	free_solver_state(st);
+	free(st);
+	return NULL;
+}
+
+/*
+	Makes opt->count puzzles with nthreads workers and prints them to out, one linear record
+	per line, and sets *attempts to the number of puzzles started (some may have been thrown
+	away). Returns 0 (after printing why) if a puzzle could not be made within the bands:
+	the puzzles before it are still printed.
+*/
+int generate(const gen_options * opt, output_writer * out, int nthreads, long long * attempts)
+{
+	generator g;
+	int i;
+	g.opt = opt;
+	g.nslots = 2 * nthreads + 2;
+	g.slots = alloc_aligned(g.nslots * sizeof(gen_chunk));
+	assert(g.slots != NULL);
+	for(i = 0; i < g.nslots; i++)
+		g.slots[i].state = SLOT_FREE;
+	g.nchunks = (opt->count + GEN_CHUNK_SIZE - 1) / GEN_CHUNK_SIZE;
+	g.next = 0;
+	g.attempts = 0;
+	pthread_mutex_init(&g.lock, NULL);
+	pthread_cond_init(&g.done, NULL);
+	pthread_cond_init(&g.free, NULL);
+
+	pthread_t * workers = malloc(nthreads * sizeof(pthread_t));
+	assert(workers != NULL);
+	for(i = 0; i < nthreads; i++)
+		pthread_create(&workers[i], NULL, gen_worker, &g);
+
+	long w, failed = -1;
+	pthread_mutex_lock(&g.lock);
+	for(w = 0; w < g.nchunks; w++)
+		{
+			gen_chunk * c = &g.slots[w % g.nslots];
+			while(!(c->state == SLOT_DONE && c->index == w))
+				pthread_cond_wait(&g.done, &g.lock);
+			int print = failed < 0;	// nothing after the puzzle given up is printed
+			if (print && c->failed >= 0)
+				{
+					failed = c->failed;
+					g.nchunks = g.next;		// the chunks already taken still have to be waited for
+				}
+			pthread_mutex_unlock(&g.lock);
+
+			if (print)
+				write_output(out, c->text, c->text_length);
+
+			pthread_mutex_lock(&g.lock);
+			c->state = SLOT_FREE;
+			pthread_cond_broadcast(&g.free);
+		}
+	pthread_mutex_unlock(&g.lock);
+
+	for(i = 0; i < nthreads; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	free(g.slots);
+	pthread_mutex_destroy(&g.lock);
+	pthread_cond_destroy(&g.done);
+	pthread_cond_destroy(&g.free);
+	*attempts = g.attempts;
+	if (failed >= 0)
+		fprintf(stderr, "--generate: no puzzle within the bands after %d starts (puzzle %ld)\n", GEN_MAX_ATTEMPTS, failed + 1);
+	return failed < 0;
+}
+
+/*
+	Service mode.
+	The solver listens on a Unix socket or a TCP port and answers newline-delimited linear
+	puzzles, one reply line per puzzle, in order. Each of the T worker threads keeps its own
+	solver state (boards allocated at the first puzzle of each size, like a batch worker) and
+	serves one connection at a time: clients may send many puzzles without waiting, and the
+	replies go out together whenever no complete request is left to read. --max-nodes bounds
+	the search of every request, so that one hard puzzle cannot hold a connection for long.
+
+	A reply is the status (solved, unsolvable, or timeout when the node budget ran out, and
+	error for a malformed request), the solution on one line (or the number of solutions with
+	--output=count, with * in the cells left open otherwise), and the statistics of the search
+	(see sprint_stats), separated by spaces.
+*/
+
+#define SERVE_BACKLOG 64
+#define SERVE_ACCEPT_PAUSE_MS 100	// before accepting again after a failure other than an aborted connection
+#define REPLY_BLOCK_SIZE (1 << 16)
+#define REPLY_TEXT_SIZE (2 * RECORD_TEXT_SIZE)		// status, board and statistics
+
+typedef struct {
+	const solver_options * opt;
+	int listener;
+} server;
+
+/*
+	Opens a listening socket for address: unix:PATH (an old socket at PATH is replaced) or
+	tcp:[HOST:]PORT (HOST defaults to the loopback). Returns -1 (after printing why) if it fails.
+*/
+int open_listener(const char * address)
+{
+	int fd;
+	if (strncmp(address, "unix:", 5) == 0)
+		{
+			struct sockaddr_un sun;
+			memset(&sun, 0, sizeof(sun));
+			sun.sun_family = AF_UNIX;
+			if (strlen(address + 5) >= sizeof(sun.sun_path))
+				{
+					fprintf(stderr, "%s: socket path too long\n", address);
+					return -1;
+				}
+			strcpy(sun.sun_path, address + 5);
+			unlink(sun.sun_path);
+			fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd < 0 || bind(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0 || listen(fd, SERVE_BACKLOG) < 0)
+				{
+					perror(address);
+					return -1;
+				}
+			return fd;
+		}
+	if (strncmp(address, "tcp:", 4) == 0)
+		{
+			char host[256] = "127.0.0.1";
+			const char * port = strrchr(address + 4, ':');
+			if (port)
+				{
+					if (port - (address + 4) >= (long) sizeof(host))
+						{
+							fprintf(stderr, "%s: host name too long\n", address);
+							return -1;
+						}
+					memcpy(host, address + 4, port - (address + 4));
+					host[port - (address + 4)] = '\0';
+					port++;
+				}
+			else
+				port = address + 4;
+
+			struct addrinfo hints, * ai;
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags = AI_PASSIVE;
+			int error = getaddrinfo(host, port, &hints, &ai);
+			if (error != 0)
+				{
+					fprintf(stderr, "%s: %s\n", address, gai_strerror(error));
+					return -1;
+				}
+			int on = 1;
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd >= 0)
+				setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+			if (fd < 0 || bind(fd, ai->ai_addr, ai->ai_addrlen) < 0 || listen(fd, SERVE_BACKLOG) < 0)
+				{
+					perror(address);
+					freeaddrinfo(ai);
+					return -1;
+				}
+			freeaddrinfo(ai);
+			return fd;
+		}
+	fprintf(stderr, "%s: expected unix:PATH or tcp:[HOST:]PORT\n", address);
+	return -1;
+}
+
+/*
+	Like write_all, but returns 0 instead of exiting when the client went away.
+*/
+int send_all(int fd, const char * text, size_t length)
+{
+	while(length > 0)
+		{
+			ssize_t n = send(fd, text, length, MSG_NOSIGNAL);
+			if (n < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					return 0;
+				}
+			text += n;
+			length -= n;
+		}
+	return 1;
+}
+
+/*
+	Solves p and writes its reply line to out (REPLY_TEXT_SIZE chars). Returns its length.
+*/
+int sprint_reply(const solver_options * opt, solver_state * st, puzzle * p, char * out)
+{
+	char * start = out;
+	solver_stats * stats = run_engine(opt, st, p);
+	const char * status = stats->timeouts ? "timeout" : stats->solutions ? "solved" : "unsolvable";
+
+	out += sprintf(out, "%s ", status);
+	if (opt->output == COUNT_OUTPUT)
+		out += sprint_count(opt, stats, out);
+	else
+		out += sprint_result(opt, st, p->box_size, LINEAR_VALUE, out);
+	out[-1] = ' ';
+	out += sprint_stats(stats, p->box_size * p->box_size, out);
+	return out - start;
+}
+
+/*
+	Answers the requests of one client until it closes the connection.
+*/
+void serve_client(const solver_options * opt, solver_state * st, int fd, const char * name)
+{
+	input_reader in;
+	char * reply = malloc(REPLY_BLOCK_SIZE);
+	size_t length = 0;
+	int status, ok = 1;
+	assert(reply != NULL);
+
+	open_stream(&in, fd, name);
+	if (opt->engine == COUNTER_ENGINE)
+		in.only_box_size = SQRT_N;
+	while(ok)
+		{
+			// send what is ready before waiting for the client
+			if (length > 0 && (!has_line(&in) || length + REPLY_TEXT_SIZE > REPLY_BLOCK_SIZE))
+				{
+					ok = send_all(fd, reply, length);
+					length = 0;
+				}
+			puzzle p;
+			status = read_input(&in, &p, LINEAR_INPUT);
+			if (status == 0)
+				break;
+			if (status < 0)
+				length += sprintf(reply + length, "error\n");
+			else
+				length += sprint_reply(opt, st, &p, reply + length);
+		}
+	if (ok && length > 0)
+		send_all(fd, reply, length);
+	close_input(&in);
+	free(reply);
+}
+
+void * serve_worker(void * arg)
+{
+	server * sv = arg;
+	solver_state * st = alloc_aligned(sizeof(solver_state));
+	assert(st != NULL);
+	new_solver_state(st);
+
+	for(;;)
+		{
+			int fd = accept(sv->listener, NULL, NULL);
+			if (fd < 0)
+				{
+					if (errno == EINTR || errno == ECONNABORTED)
+						continue;
+					// out of descriptors or memory for now (EMFILE, ENFILE, ENOBUFS...): the
+					// clients being served will give some back, so wait a little and go on
+					perror("accept");
+					struct timespec pause = {0, SERVE_ACCEPT_PAUSE_MS * 1000000L};
+					nanosleep(&pause, NULL);
+					continue;
+				}
+			char name[32];
+			sprintf(name, "<client %d>", fd);
+			serve_client(sv->opt, st, fd, name);
+		}
+	return NULL;
+}
+
+/*
+	Serves requests on address with nthreads worker threads, which never returns unless
+	address cannot be listened on.
+*/
+int serve(const solver_options * opt, const char * address, int nthreads)
+{
+	server sv;
+	sv.opt = opt;
+	sv.listener = open_listener(address);
+	if (sv.listener < 0)
+		return 0;
+
+	int i;
+	pthread_t * workers = malloc(nthreads * sizeof(pthread_t));
+	assert(workers != NULL);
+	for(i = 1; i < nthreads; i++)
+		pthread_create(&workers[i], NULL, serve_worker, &sv);
+	serve_worker(&sv);
+	return 1;
+}
+
+/*
+	Benchmark.
+	Every corpus is loaded in memory first, then solved warmup times untimed and repeat
+	times timed, one puzzle at a time, so that parsing and printing stay out of the numbers.
+	Prints one CSV line (or JSON object) per corpus: throughput in puzzles and search nodes
+	per second, and the latency of single puzzles.
+*/
+
+enum bench_format { CSV_BENCH, JSON_BENCH };
+
+const char * engine_names[] = { "bitmask", "counter", "simd", "dlx" };
+const char * propagation_names[] = { "none", "singles", "full" };
+const char * backtrack_names[] = { "undo", "copy", "iterative" };
+const char * cell_order_names[] = { "first", "degree" };
+const char * value_order_names[] = { "ascending", "lcv" };
+const char * branching_names[] = { "cell", "unit" };
+
+double elapsed_us(struct timespec * start, struct timespec * end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+int compare_doubles(const void * a, const void * b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+/*
+	Bytes of the board of opt's engine for box_size, and of its whole state for one thread
+	(the board, its undo information or scratch space, and its statistics).
+*/
+void engine_bytes(const solver_options * opt, int box_size, size_t * board, size_t * state)
+{
+	if (opt->engine == COUNTER_ENGINE)
+		{
+			*board = offsetof(sudoku, possibilities);
+			*state = sizeof(sudoku);
+		}
+	else if (opt->engine == DLX_ENGINE)
+		*board = *state = sizeof(dlx);
+	else
+		{
+			*board = board_kinds[box_size]->hot_bytes;
+			*state = board_kinds[box_size]->board_bytes;
+		}
+}
+
+/*
+	Returns 0 if the corpus could not be read.
+*/
+int bench_corpus(const solver_options * opt, const char * path, enum input_type intype, int warmup, int repeat, enum bench_format format)
+{
+	input_reader in;
+	if (!open_input(&in, path))
+		return 0;
+	if (opt->engine == COUNTER_ENGINE)
+		in.only_box_size = SQRT_N;
+
+	int npuzzles = 0, capacity = 1024, status;
+	puzzle * puzzles = malloc(capacity * sizeof(puzzle));
+	assert(puzzles != NULL);
+	while((status = read_input(&in, &puzzles[npuzzles], intype)) > 0)
+		if (++npuzzles == capacity)
+			{
+				capacity *= 2;
+				puzzles = realloc(puzzles, capacity * sizeof(puzzle));
+				assert(puzzles != NULL);
+			}
+	close_input(&in);
+	if (status < 0 || npuzzles == 0)
+		{
+			if (npuzzles == 0)
+				fprintf(stderr, "%s: no puzzles\n", in.name);
+			free(puzzles);
+			return 0;
+		}
+
+	solver_state * st = alloc_aligned(sizeof(solver_state));
+	new_solver_state(st);
+	double * latency = malloc((size_t) npuzzles * repeat * sizeof(double));
+	assert(st != NULL && latency != NULL);
+
+	// puzzles solved together (SIMD lanes) all take the time of their group
+	int group = group_size(opt);
+	int r, i, k;
+	for(r = 0; r < warmup; r++)
+		solve_puzzles(opt, st, puzzles, npuzzles, NULL, NULL);
+
+	long long nnodes = 0, nbacktracks = 0;
+	double total_us = 0;
+	for(r = 0; r < repeat; r++)
+		for(i = 0; i < npuzzles; i += group)
+			{
+				struct timespec start, end;
+				int n = npuzzles - i < group ? npuzzles - i : group;
+				long long before = st->total.nodes, before_backtracks = st->total.backtracks;
+				clock_gettime(CLOCK_MONOTONIC, &start);
+				solve_puzzles(opt, st, &puzzles[i], n, NULL, NULL);
+				clock_gettime(CLOCK_MONOTONIC, &end);
+				nnodes += st->total.nodes - before;
+				nbacktracks += st->total.backtracks - before_backtracks;
+				for(k = 0; k < n; k++)
+					latency[r*npuzzles + i + k] = elapsed_us(&start, &end);
+				total_us += elapsed_us(&start, &end);
+			}
+
+	long nsamples = (long) npuzzles * repeat;
+	qsort(latency, nsamples, sizeof(double), compare_doubles);
+	double seconds = total_us / 1e6;
+	double p50 = latency[nsamples / 2];
+	double p99 = latency[(long) (nsamples * 0.99)];
+	double max = latency[nsamples - 1];
+	int own_search = opt->engine == COUNTER_ENGINE || opt->engine == DLX_ENGINE;	// no options of the bitmask engine
+	const char * propagation = propagation_names[own_search ? NO_PROPAGATION : opt->propagation];
+	const char * backtrack = backtrack_names[own_search ? UNDO_BACKTRACK : opt->backtrack];
+	const char * cell_order = cell_order_names[own_search ? FIRST_CELL : opt->cell_order];
+	const char * value_order = value_order_names[own_search ? ASCENDING_VALUES : opt->value_order];
+	const char * branching = branching_names[own_search ? CELL_BRANCHING : opt->branching];
+	long long restarts = own_search ? 0 : opt->restart_nodes;
+	size_t board_bytes, state_bytes;		// of the size of the first puzzle
+	engine_bytes(opt, puzzles[0].box_size, &board_bytes, &state_bytes);
+
+	if (format == CSV_BENCH)
+		printf("%s,%s,%s,%s,%s,%s,%s,%lld,%d,%d,%d,%.6f,%.1f,%.1f,%.2f,%.2f,%.2f,%lld,%zu,%zu\n", in.name, engine_names[opt->engine], propagation, backtrack,
+			cell_order, value_order, branching, restarts, npuzzles, warmup, repeat, seconds, nsamples / seconds, nnodes / seconds, p50, p99, max,
+			nbacktracks / repeat, board_bytes, state_bytes);
+	else
+		printf("{\"corpus\": \"%s\", \"engine\": \"%s\", \"propagation\": \"%s\", \"backtrack\": \"%s\", \"cell_order\": \"%s\", "
+			"\"value_order\": \"%s\", \"branching\": \"%s\", \"restarts\": %lld, \"puzzles\": %d, \"warmup\": %d, \"repeat\": %d, "
+			"\"seconds\": %.6f, \"puzzles_per_sec\": %.1f, \"nodes_per_sec\": %.1f, \"p50_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f, "
+			"\"backtracks\": %lld, \"board_bytes\": %zu, \"state_bytes\": %zu}\n",
+			in.name, engine_names[opt->engine], propagation, backtrack, cell_order, value_order, branching, restarts,
+			npuzzles, warmup, repeat, seconds, nsamples / seconds, nnodes / seconds, p50, p99, max, nbacktracks / repeat,
+			board_bytes, state_bytes);
+	fflush(stdout);
+
+	free(latency);
+	free_solver_state(st);
+	free(st);
+	free(puzzles);
+	return 1;
+}
+
+/*
+	Library interface (see sudoku_solver.h): a context is the options and the solver state
+	of one thread, as a batch worker has them.
+*/
+
+struct solver_context {
+	solver_options opt;
+	solver_state st;
+};
+
+solver_context * solver_create(const char * options)
+{
+	solver_context * ctx = alloc_aligned(sizeof(solver_context));
+	char arg[256];
+	const char * next = options;
+	assert(ctx != NULL);
+	ctx->opt = default_options;
+	int ok = 1;
+	while(ok && next && *next)
+		{
+			size_t length = strcspn(next, " \t");
+			if (length > 0)
+				{
+					ok = length < sizeof(arg);
+					if (ok)
+						{
+							memcpy(arg, next, length);
+							arg[length] = '\0';
+							ok = parse_solver_option(&ctx->opt, arg);
+						}
+				}
+			next += length;
+			next += strspn(next, " \t");
+		}
+	if (!ok || !valid_options(&ctx->opt))
+		{
+			free(ctx);
+			return NULL;
+		}
+	if (ctx->opt.output != COUNT_OUTPUT)
+		ctx->opt.output = LINEAR_OUTPUT;
+	if (ctx->opt.cache_size > 0)
+		ctx->opt.cache = new_cache(ctx->opt.cache_size);
+	new_solver_state(&ctx->st);
+	return ctx;
+}
+
+void solver_destroy(solver_context * ctx)
+{
+	if (ctx->opt.cache)
+		free_cache(ctx->opt.cache);
+	free_solver_state(&ctx->st);
+	free(ctx);
+}
+
+int solver_solve(solver_context * ctx, const char * text, char * out, solver_result_stats * result)
+{
+	size_t length = strlen(text);
+	puzzle p;
+	p.box_size = box_size_of(length, LINEAR_INPUT);
+	if (p.box_size == 0 || (ctx->opt.engine == COUNTER_ENGINE && p.box_size != SQRT_N))
+		return SOLVER_ERROR;
+	if (parse_cells(text, length, p.box_size * p.box_size, p.cell) >= 0 || !is_consistent(&p))
+		return SOLVER_ERROR;
+
+	solver_stats * stats = run_engine(&ctx->opt, &ctx->st, &p);
+	if (ctx->opt.output == COUNT_OUTPUT)
+		out[0] = '\0';		// the board is wherever the count stopped: only the count means something
+	else
+		out[sprint_result(&ctx->opt, &ctx->st, p.box_size, LINEAR_VALUE, out) - 1] = '\0';
+	if (result)
+		{
+			result->nodes = stats->nodes;
+			result->backtracks = stats->backtracks;
+			result->max_depth = stats->max_depth;
+			result->propagated = stats->propagated;
+			result->eliminated = stats->eliminated;
+			result->solutions = stats->solutions;
+		}
+	return stats->timeouts ? SOLVER_TIMEOUT : stats->solutions > 1 ? SOLVER_MULTIPLE : stats->solutions ? SOLVER_SOLVED
+		: SOLVER_UNSOLVABLE;
+}
+
+int solver_solve_batch(solver_context * ctx, const char * const * puzzles, int count, char * const * out,
+	int * results, solver_result_stats * stats)
+{
+	int i, nsolved = 0;
+	for(i = 0; i < count; i++)
+		{
+			results[i] = solver_solve(ctx, puzzles[i], out[i], stats ? &stats[i] : NULL);
+			nsolved += results[i] == SOLVER_SOLVED || results[i] == SOLVER_MULTIPLE;
+		}
+	return nsolved;
+}
+
+#ifndef SUDOKU_LIBRARY
+int main (int argc, char const *argv[])
+{
+	solver_options opt = default_options;
+	int intype = 0;
+	int nthreads = 1;
+	const char * path = NULL;
+	const char * address = NULL;	// of --serve
+	const char * rank_dir = NULL;	// of --rank
+	int top = 10;
+	gen_options gen = { 0, 1, 0, N*N, 0, 0 };	// --generate=COUNT and its bands
+	slow_lane lane = { 0, 0, 0 };		// --slow-lane=T and its budgets
+	const char * corpora[argc];		// files given to --bench
+	int ncorpora = 0, bench = 0, warmup = 1, repeat = 3;
+	enum bench_format bench_format = CSV_BENCH;
+	int summary = 0;
+	int pack = 0;
+	int stream = 0, unordered = 0;	// --stream[=unordered]
+	int shard = 0, nshards = 0;		// --shard=I/K
+	const char * checkpoint_dir = NULL;
+	double interval = 10;			// --checkpoint-interval, in seconds
+	const char * merge_dir = NULL;
+	input_reader in;
+	output_writer out;
+	
+	int a;
+	for(a = 1; a < argc; a++)
+		{
+			if (parse_solver_option(&opt, argv[a]))
+				continue;
+			if (strncmp(argv[a], "--input=", 8) == 0)
+				path = corpora[ncorpora++] = argv[a] + 8;
+			else if (strcmp(argv[a], "--summary") == 0)
+				summary = 1;
+			else if (strcmp(argv[a], "--bench") == 0)
+				bench = 1;
+			else if (strcmp(argv[a], "--pack") == 0)
+				pack = 1;
+			else if (strcmp(argv[a], "--stream") == 0 || strcmp(argv[a], "--stream=ordered") == 0)
+				stream = 1;
+			else if (strcmp(argv[a], "--stream=unordered") == 0)
+				stream = unordered = 1;
+			else if (strncmp(argv[a], "--serve=", 8) == 0)
+				address = argv[a] + 8;
+			else if (strncmp(argv[a], "--rank=", 7) == 0)
+				rank_dir = argv[a] + 7;
+			else if (strncmp(argv[a], "--top=", 6) == 0)
+				top = atoi(argv[a] + 6);
+			else if (strncmp(argv[a], "--generate=", 11) == 0)
+				gen.count = atol(argv[a] + 11);
+			else if (strncmp(argv[a], "--seed=", 7) == 0)
+				gen.seed = strtoull(argv[a] + 7, NULL, 10);
+			else if (strncmp(argv[a], "--clues=", 8) == 0)
+				{
+					if (sscanf(argv[a] + 8, "%d-%d", &gen.min_clues, &gen.max_clues) != 2)
+						gen.min_clues = -1;
+				}
+			else if (strncmp(argv[a], "--rating=", 9) == 0)
+				{
+					if (sscanf(argv[a] + 9, "%lld-%lld", &gen.min_rating, &gen.max_rating) != 2)
+						gen.min_rating = -1;
+				}
+			else if (strncmp(argv[a], "--warmup=", 9) == 0)
+				warmup = atoi(argv[a] + 9);
+			else if (strncmp(argv[a], "--repeat=", 9) == 0)
+				repeat = atoi(argv[a] + 9);
+			else if (strcmp(argv[a], "--bench-format=csv") == 0)
+				bench_format = CSV_BENCH;
+			else if (strcmp(argv[a], "--bench-format=json") == 0)
+				bench_format = JSON_BENCH;
+			else if (strncmp(argv[a], "--threads=", 10) == 0)
+				nthreads = atoi(argv[a] + 10);
+			else if (strncmp(argv[a], "--shard=", 8) == 0)
+				{
+					if (sscanf(argv[a] + 8, "%d/%d", &shard, &nshards) != 2 || shard < 1 || shard > nshards)
+						shard = -1;
+				}
+			else if (strncmp(argv[a], "--checkpoint=", 13) == 0)
+				checkpoint_dir = argv[a] + 13;
+			else if (strncmp(argv[a], "--checkpoint-interval=", 22) == 0)
+				interval = atof(argv[a] + 22);
+			else if (strncmp(argv[a], "--merge=", 8) == 0)
+				merge_dir = argv[a] + 8;
+			else if (strncmp(argv[a], "--slow-lane=", 12) == 0)
+				lane.nthreads = atoi(argv[a] + 12);
+			else if (strncmp(argv[a], "--slow-nodes=", 13) == 0)
+				lane.max_nodes = atoll(argv[a] + 13);
+			else if (strncmp(argv[a], "--slow-time=", 12) == 0)
+				lane.max_time = atof(argv[a] + 12);
+			else
+				{
+					// the input type, given once as a number; any other argument is an unknown option
+					char * end;
+					long type = strtol(argv[a], &end, 10);
+					intype = intype == 0 && argv[a][0] >= '0' && argv[a][0] <= '9' && *end == '\0'
+						&& type >= LINEAR_INPUT && type <= PACKED_INPUT ? type : -1;
+				}
+		}
+	
+	if (checkpoint_dir && shard == 0)
+		shard = nshards = 1;		// the whole input, resumable
+	if ((address || gen.count > 0 || merge_dir) && intype == 0)
+		intype = LINEAR_INPUT;		// requests are always linear, and the generator and the merge have no input
+	if (intype < LINEAR_INPUT || intype > PACKED_INPUT || (pack && intype == PACKED_INPUT) || nthreads < 1 || !valid_options(&opt)
+		|| top < 0 || gen.count < 0 || gen.min_clues < 0 || gen.max_clues < gen.min_clues
+		|| (gen.count > 0 && gen.max_clues < GEN_MIN_CLUES) || gen.min_rating < 0
+		|| (gen.max_rating && gen.max_rating < gen.min_rating) || warmup < 0 || repeat < 1 || lane.nthreads < 0 || lane.max_nodes < 0
+		|| lane.max_time < 0 || (lane.nthreads > 0 && (!(opt.max_nodes || opt.max_time) || rank_dir || opt.output == COUNT_OUTPUT
+			|| opt.output == RATING_OUTPUT || (lane.max_nodes && lane.max_nodes <= opt.max_nodes)))
+		|| (stream && (rank_dir || pack || lane.nthreads > 0 || nthreads > STREAM_RECORDS)) || shard < 0 || interval < 0
+		|| (shard && (!path || intype == GRID_INPUT || stream || pack || bench || address || gen.count > 0 || (rank_dir && checkpoint_dir)))
+		|| (merge_dir && shard))
+		{
+			printf("Usage:\n $ %s [--engine=bitmask|counter|simd|dlx] [--propagate=none|singles|full] [--backtrack=undo|copy|iterative] [--max-nodes=K] [--max-time=MS] [--threads=T] [--slow-lane=L [--slow-nodes=K] [--slow-time=MS]] [--search-threads=S [--split-depth=D]] [--cell-order=first|degree] [--value-order=ascending|lcv] [--branch=cell|unit] [--restarts=K] [--lane-depth=D] [--profile] [--phase-counter=EVENT] [--input=FILE] [--output=grid|linear|stats|count|rating|profile [--count-limit=L]] [--cache=E] [--summary] <1=linear | 2=grid | 3=packed>\n < input_file.txt", argv[0]);
+			printf("\n $ %s --bench [--warmup=W] [--repeat=R] [--bench-format=csv|json] [solver options] --input=FILE... <1=linear | 2=grid | 3=packed>", argv[0]);
+			printf("\n $ %s --stream[=ordered|unordered] [--threads=T] [solver options] [--input=FILE] <1=linear | 2=grid | 3=packed>", argv[0]);
+			printf("\n $ %s --pack [--input=FILE] <1=linear | 2=grid> < input_file.txt > packed_file", argv[0]);
+			printf("\n $ %s --rank=DIR [--top=K] [--threads=T] [solver options] [--input=FILE] <1=linear | 2=grid | 3=packed>", argv[0]);
+			printf("\n $ %s --shard=I/K [--checkpoint=DIR | --rank=DIR [--top=K]] [--checkpoint-interval=S] [--threads=T] [solver options] --input=FILE <1=linear | 3=packed>", argv[0]);
+			printf("\n $ %s --merge=DIR [--summary]", argv[0]);
+			printf("\n $ %s --generate=COUNT [--seed=S] [--clues=MIN-MAX] [--rating=MIN-MAX] [--threads=T] [--summary]", argv[0]);
+			printf("\n $ %s --serve=unix:PATH|tcp:[HOST:]PORT [--threads=T] [solver options]\n", argv[0]);
+			exit(1);
+		}
+	
+	if (opt.profile)
+		{
+			profile_counters probe;
+			if (!open_profile(&probe, 1))
+				{
+					fprintf(stderr, "--profile: no hardware counter can be read on this machine\n");
+					exit(1);
+				}
+			close_profile(&probe);
+		}
+	if (opt.phase_event && !open_phase_counter(opt.phase_event - 1))
+		{
+			fprintf(stderr, "--phase-counter: %s cannot be counted (%s)\n", profile_event_names[opt.phase_event - 1], strerror(errno));
+			exit(1);
+		}
+	
+	if (opt.cache_size > 0)
+		opt.cache = new_cache(opt.cache_size);
+	
+	if (bench)
+		{
+			int ok = 1;
+			if (bench_format == CSV_BENCH)
+				printf("corpus,engine,propagation,backtrack,cell_order,value_order,branching,restarts,puzzles,warmup,repeat,seconds,"
+					"puzzles_per_sec,nodes_per_sec,p50_us,p99_us,max_us,backtracks,board_bytes,state_bytes\n");
+			if (ncorpora == 0)
+				corpora[ncorpora++] = NULL;		// stdin
+			for(a = 0; a < ncorpora; a++)
+				ok = bench_corpus(&opt, corpora[a], intype, warmup, repeat, bench_format) && ok;
+			return ok ? 0 : 1;
+		}
+	
+	if (address)
+		return serve(&opt, address, nthreads) ? 0 : 1;
+	
+	if (gen.count > 0)
+		{
+			open_output(&out, STDOUT_FILENO);
+			long long attempts;
+			int ok = generate(&gen, &out, nthreads, &attempts);
+			close_output(&out);
+			if (summary)
+				fprintf(stderr, "puzzles %ld\nattempts %lld\n", gen.count, attempts);
+			return !ok;
+		}
+	
+	if (merge_dir)
+		{
+			solver_state * st = alloc_aligned(sizeof(solver_state));
+			assert(st != NULL);
+			new_solver_state(st);
+			open_output(&out, STDOUT_FILENO);
+			int status = merge_shards(merge_dir, &out, st);
+			close_output(&out);
+			if (summary)
+				fprint_summary(stderr, st->npuzzles, st->max_n, &st->total);
+			free_solver_state(st);
+			free(st);
+			return status ? 0 : 1;
+		}
+	
+	if (!open_input(&in, path))
+		exit(1);
+	if (opt.engine == COUNTER_ENGINE)
+		in.only_box_size = SQRT_N;
+	
+	open_output(&out, STDOUT_FILENO);
+	
+	int status;
+	if (pack)
+		{
+			status = pack_puzzles(&in, &out, intype);
+			close_input(&in);
+			close_output(&out);
+			return status ? 0 : 1;
+		}
+	solver_state * st = alloc_aligned(sizeof(solver_state));
+	assert(st != NULL);
+	new_solver_state(st);
+	if (shard)
+		status = shard_corpus(&opt, &lane, &in, &out, st, intype, nthreads, shard, nshards, checkpoint_dir ? checkpoint_dir : rank_dir,
+			rank_dir != NULL, top, interval);
+	else if (rank_dir)
+		status = rank_corpus(&opt, &in, &out, st, intype, nthreads, rank_dir, top);
+	else if (stream)
+		status = stream_records(&opt, &in, &out, st, intype, nthreads, unordered);
+	else if (nthreads > 1 || lane.nthreads > 0)
+		status = solve_batch(&opt, &lane, &in, &out, NULL, st, intype, nthreads, NULL);
+	else
+		{
+			// read as many puzzles as the engine solves at once
+			puzzle p[SIMD_MAX_LANES];
+			char text[SIMD_MAX_LANES * RECORD_TEXT_SIZE];
+			int group = group_size(&opt), n;
+			do
+				{
+					for(n = 0; n < group && (status = read_input(&in, &p[n], intype)) > 0; n++)
+						;
+					write_output(&out, text, solve_puzzles(&opt, st, p, n, text, NULL));
+				}
+			while(status > 0);
+			status = status == 0;
+		}
+	close_input(&in);
+	close_output(&out);
+	if (summary)
+		fprint_summary(stderr, st->npuzzles, st->max_n, &st->total);
+	if (summary && opt.profile)
+		fprint_profile(stderr, &st->total);
+	if (summary && opt.cache)
+		fprint_cache(stderr, opt.cache);
+	if (opt.cache)
+		free_cache(opt.cache);
+	free_solver_state(st);
+	free(st);
+		
+	return status ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*
+	Library interface of the Sudoku solver.
+
+	Build with "make lib" (libsudoku.a and libsudoku.so) and link with -lsudoku -pthread.
+	A context holds everything one thread needs to solve puzzles: its options and its boards,
+	allocated the first time a puzzle of each size is solved and reused after that, so
+	solving does not allocate (except with --search-threads, which starts threads for every
+	puzzle). A context must only be used by one thread at a time; separate contexts can be
+	used concurrently.
+
+	Puzzles are given in the linear format, as NUL-terminated strings of 16, 81, 256 or 625
+	cells (numbers 1-9 then A-P, blanks as 0, . or _). Solutions come back in the same
+	format, with * for the cells left open when there is no solution or the search ran out
+	of nodes or time, in buffers of at least SOLVER_TEXT_SIZE chars. With --output=count, no
+	solution comes back (the buffer gets an empty string), only the number of solutions.
+*/
+
+#ifndef SUDOKU_SOLVER_H
+#define SUDOKU_SOLVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SOLVER_API __attribute__ ((visibility ("default")))
+
+#define SOLVER_TEXT_SIZE (25 * 25 + 1)	// the largest board, and the NUL
+
+// return values of solver_solve
+enum {
+	SOLVER_ERROR = -1,		// malformed puzzle: wrong length, unexpected character, number given twice in a unit
+	SOLVER_UNSOLVABLE = 0,
+	SOLVER_SOLVED = 1,
+	SOLVER_TIMEOUT = 2,		// the search went beyond --max-nodes or --max-time
+	SOLVER_MULTIPLE = 3		// with --output=count, 2 solutions or more
+};
+
+typedef struct solver_context solver_context;
+
+// statistics of one search
+typedef struct {
+	long long nodes;
+	long long backtracks;
+	int max_depth;
+	long long propagated;	// cells filled by propagation
+	long long eliminated;	// other hypothesis removed by propagation
+	long long solutions;	// 0 or 1, or up to the limit with --output=count
+} solver_result_stats;
+
+/*
+	Returns a new context, or NULL if options (a space-separated list of the solver options
+	of the command line: --engine, --propagate, --backtrack, --max-nodes, --max-time, --search-threads,
+	--split-depth, --output=count and --count-limit, --cache, --cell-order, --value-order,
+	--branch, --restarts) has an unknown or invalid one.
+	options can be NULL for the defaults. With --output=count, the context counts the solutions
+	of every puzzle instead of solving it: see solver_solve.
+*/
+SOLVER_API solver_context * solver_create(const char * options);
+
+SOLVER_API void solver_destroy(solver_context * ctx);
+
+/*
+	Solves puzzle, writes the solution to out and, if stats is not NULL, the statistics of the
+	search to stats. Returns SOLVER_SOLVED, SOLVER_UNSOLVABLE, SOLVER_TIMEOUT or SOLVER_ERROR
+	(out is then left as it was).
+	With --output=count, out only gets an empty string and stats->solutions holds the count
+	(up to --count-limit); it returns SOLVER_SOLVED for a single solution, SOLVER_MULTIPLE for
+	more, SOLVER_UNSOLVABLE for none, and SOLVER_TIMEOUT if the count went beyond --max-nodes
+	or --max-time (stats->solutions then holds the solutions found so far). The dlx engine
+	has no budgets, for counting or solving.
+*/
+SOLVER_API int solver_solve(solver_context * ctx, const char * puzzle, char * out, solver_result_stats * stats);
+
+/*
+	Solves count puzzles one after the other, as solver_solve would: out[i] gets the i-th
+	solution, results[i] its return value and stats[i] (if stats is not NULL) its statistics.
+	Returns the number of puzzles solved (SOLVER_SOLVED or SOLVER_MULTIPLE).
+*/
+SOLVER_API int solver_solve_batch(solver_context * ctx, const char * const * puzzles, int count, char * const * out,
+	int * results, solver_result_stats * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif